@@ -0,0 +1,173 @@
+/**
+ * @file
+ * @author Peter Szucs <peter.szucs.dev@gmail.com>
+ *
+ * @section LICENSE
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @class batching_producer
+ * \brief Collects the items of a pushing thread, and pushes them to the queue in batches.
+ * 
+ * Use this, when the producer pushes one item at a time, but the range push would be faster.
+ * The items are buffered in the object, and pushed with one range push (one atomic operation for the positions), when:
+ * 	- the buffer is full,
+ * 	- the oldest buffered item waits for maxDelay,
+ * 	- flush() is called, or the object is destroyed.
+ * When the queue is empty (the workers are waiting), the first item is pushed directly, so light traffic isn't delayed.
+ * The delay is only checked at push() and flushIfDue(), call flushIfDue() when the producer is idle.
+ * Works with circular_queue, dynamic_circular_queue and sequence_circular_queue.
+ *
+ * example: circular_queue<int, 1024> tasks; then in every pushing thread:
+ * 	batching_producer<circular_queue<int, 1024> > producer(tasks); producer.push(item);
+ */
+
+#ifndef BATCHING_PRODUCER_H
+#define BATCHING_PRODUCER_H
+
+#include "circular_queue.h"
+#include <boost/move/iterator.hpp> //make_move_iterator()
+
+/*! \brief The batching adapter of a pushing thread.
+ * 
+ * Not thread-safe, every pushing thread needs its own.
+ * 
+ * @tparam Queue Type of the queue, with range push.
+ * @tparam batch Maximum number of buffered items.
+ */
+template <class Queue, boost::uint32_t batch = 16u>
+class batching_producer {
+public:
+	typedef typename Queue::value_type value_type;
+
+	/*! \brief Creates the adapter.
+	 * 
+	 * @param queue The queue to push to.
+	 * @param maxDelay Maximum time, while an item is buffered. Zero means no deadline, only full buffer and flush().
+	 */
+	explicit batching_producer(Queue &queue, boost::chrono::microseconds maxDelay = boost::chrono::microseconds(100)) :
+		mQueue(queue),
+		mMaxDelay(maxDelay),
+		mCount(0)
+	{
+		BOOST_STATIC_ASSERT( batch != 0 );
+	}
+
+	//! Pushes the buffered items.
+	~batching_producer(){
+		flush();
+	}
+
+	/*! \brief Adds the item to the buffer, and pushes the buffer, when it is full or the deadline is reached.
+	 * 
+	 * Waits, when the queue is full.
+	 * 
+	 * @param item The item to push.
+	 */
+	void push(const value_type &item){
+		if(mCount == 0 && mQueue.isEmpty()){
+			mQueue.push(item);
+			return;
+		}
+		new (buffered(mCount)) value_type(item);
+		added();
+	}
+#ifndef BOOST_NO_CXX11_RVALUE_REFERENCES
+	/*! \brief Adds the item to the buffer, and pushes the buffer, when it is full or the deadline is reached.
+	 * 
+	 * Same as push(const value_type&), but the item is moved.
+	 * 
+	 * @param item The item to push.
+	 */
+	void push(value_type &&item){
+		if(mCount == 0 && mQueue.isEmpty()){
+			mQueue.push(std::move(item));
+			return;
+		}
+		new (buffered(mCount)) value_type(std::move(item));
+		added();
+	}
+#endif
+
+	/*! \brief Pushes the buffered items to the queue.
+	 * 
+	 * Waits, when the queue is full.
+	 */
+	void flush(){
+		if(mCount == 0)
+			return;
+		value_type *first = buffered(0);
+		mQueue.push(boost::make_move_iterator(first), boost::make_move_iterator(first + mCount));
+		for(boost::uint32_t i = 0; i < mCount; i++){
+			first[i].~value_type();
+		}
+		mCount = 0;
+	}
+
+	/*! \brief Pushes the buffered items, when the oldest waits for maxDelay.
+	 * 
+	 * Call it, when the producer is idle, so the items won't stay in the buffer.
+	 * 
+	 * @return True, when the buffer was pushed.
+	 */
+	bool flushIfDue(){
+		if(mCount == 0 || !isDue())
+			return false;
+		flush();
+		return true;
+	}
+
+	/*! \brief Gets the number of buffered items.
+	 */
+	boost::uint32_t getBufferedCount() const {
+		return mCount;
+	}
+
+	/*! \brief Gets the queue.
+	 */
+	Queue& getQueue(){
+		return mQueue;
+	}
+private:
+	batching_producer(const batching_producer&);
+	batching_producer& operator=(const batching_producer&);
+
+	typedef circular_queue_detail::timeout_clock clock;
+
+	value_type* buffered(boost::uint32_t index){
+		return static_cast<value_type*>(static_cast<void*>(&mItems)) + index;
+	}
+	void added(){
+		if(++mCount == 1 && mMaxDelay.count() != 0)
+			mDeadline = clock::now() + mMaxDelay;
+		if(mCount == batch || (mCount > 1 && isDue()))
+			flush();
+	}
+	bool isDue() const {
+		return mMaxDelay.count() != 0 && clock::now() >= mDeadline;
+	}
+
+	Queue &mQueue;
+	const boost::chrono::microseconds mMaxDelay;
+	clock::time_point mDeadline; // flush time of the oldest buffered item
+	boost::uint32_t mCount; // buffered items
+	typename boost::aligned_storage<sizeof(value_type) * batch, boost::alignment_of<value_type>::value>::type mItems;
+};
+
+#endif //BATCHING_PRODUCER_H
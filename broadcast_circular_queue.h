@@ -0,0 +1,404 @@
+/**
+ * @file
+ * @author Peter Szucs <peter.szucs.dev@gmail.com>
+ *
+ * @section LICENSE
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @class broadcast_circular_queue
+ * \brief Single-producer queue, where every consumer pops every item (disruptor style).
+ * 
+ * Use this for fan-out, instead of pushing the same item to more queues.
+ * There is one ring and one write position, every consumer has its own read position on its own cache line.
+ * The item is written once, and the consumers copy it out of the same slot,
+ * so the memory traffic grows with the data, not with the number of consumers.
+ * The producer waits for the slowest consumer, when the ring is full, a consumer which stops popping
+ * needs to call removeConsumer(), otherwise it stalls the producer.
+ * The item is destroyed, when its slot is pushed again, or with the queue.
+ *
+ * example: broadcast_circular_queue<quote, 1024> quotes(3); quotes.push(item) in the pushing thread,
+ * 	boost::uint32_t consumer = quotes.addConsumer(); then quotes.pop(consumer, item) in every popping thread.
+ */
+
+#ifndef BROADCAST_CIRCULAR_QUEUE_H
+#define BROADCAST_CIRCULAR_QUEUE_H
+
+#include "circular_queue.h"
+
+/*! \brief The broadcast queue.
+ * 
+ * @tparam T Type of the items, it needs to be copy assignable.
+ * @tparam size Number of slots in the queue, needs to be power of two.
+ * @tparam Wait Wait strategy: default_wait, spin_wait, spin_yield_wait, backoff_wait, spin_sleep_wait or park_wait.
+ */
+template <typename T, boost::uint32_t size = 32u, typename Wait = default_wait>
+class broadcast_circular_queue {
+public:
+	/*! \brief Creates the queue.
+	 * 
+	 * @param consumers Number of popping threads, every one gets every item.
+	 */
+	explicit broadcast_circular_queue(boost::uint32_t consumers) :
+		mCount(consumers)
+	{
+		// 0x100000000 needs to be dividable by size or it will fail on overflow.
+		BOOST_STATIC_ASSERT( (0xFFFFFFFFu % size) == (size - 1) );
+
+		BOOST_ASSERT(consumers != 0);
+		void *memory = boost::alignment::aligned_alloc(boost::alignment_of<cursor>::value, sizeof(cursor) * mCount);
+		if(!memory)
+			throw std::bad_alloc();
+		mConsumers = static_cast<cursor*>(memory);
+		for(boost::uint32_t i = 0; i < mCount; i++){
+			new (&mConsumers[i]) cursor();
+			mConsumers[i].value.cachedWritePos = 0;
+			mConsumers[i].value.active.storeRelaxed(true);
+		}
+		mProducer.value.cachedReadPos = 0;
+		mProducer.value.filled = 0;
+	}
+
+	~broadcast_circular_queue(){
+		destroyItems();
+		for(boost::uint32_t i = 0; i < mCount; i++){
+			mConsumers[i].~cursor();
+		}
+		boost::alignment::aligned_free(mConsumers);
+	}
+
+	/*! \brief Gets a consumer index for the calling thread.
+	 * 
+	 * Every popping thread should call it once, and use the returned value in pop().
+	 * You can also use your own thread numbering, from 0 to consumers-1.
+	 * 
+	 * @return The consumer index.
+	 */
+	boost::uint32_t addConsumer(){
+		boost::uint32_t consumer = mNextConsumer.fetchAdd(1);
+		BOOST_ASSERT(consumer < mCount);
+		return consumer;
+	}
+
+	/*! \brief Stops waiting for the consumer.
+	 * 
+	 * Call it from the popping thread, when it won't pop any more, so the producer can overwrite its items.
+	 * 
+	 * @param consumer Consumer index.
+	 */
+	void removeConsumer(boost::uint32_t consumer){
+		BOOST_ASSERT(consumer < mCount);
+		mConsumers[consumer].value.active.storeRelease(false);
+		mParking.notify();
+	}
+
+	/*! \brief Push item to queue.
+	 * 
+	 * Only one thread may push.
+	 * Waits, when the slowest consumer is a full ring behind.
+	 * 
+	 * @param item The item to push to the queue.
+	 */
+	void push(const T &item){
+		boost::uint32_t mypos = claimPushSlot();
+		new (mSlots[mypos % size].get()) T(item);
+		publishPushSlot(mypos);
+	}
+#ifndef BOOST_NO_CXX11_RVALUE_REFERENCES
+	/*! \brief Push item to queue.
+	 * 
+	 * Only one thread may push, the item is moved into the queue.
+	 * 
+	 * @param item The item to push to the queue.
+	 */
+	void push(T &&item){
+		boost::uint32_t mypos = claimPushSlot();
+		new (mSlots[mypos % size].get()) T(std::move(item));
+		publishPushSlot(mypos);
+	}
+#endif
+
+	/*! \brief Push item to queue, when the slowest consumer is not a full ring behind.
+	 * 
+	 * Only one thread may push.
+	 * 
+	 * @param item The item to push to the queue.
+	 * @return True, when the item is pushed. False, when queue is full.
+	 */
+	bool tryPush(const T &item){
+		boost::uint32_t mypos = mProducer.value.writePos.loadRelaxed();
+		if(isFullAt(mypos))
+			return false;
+		freeSlot(mypos);
+		new (mSlots[mypos % size].get()) T(item);
+		publishPushSlot(mypos);
+		return true;
+	}
+
+	/*! \brief Pop the next item of the consumer.
+	 * 
+	 * Only one thread may pop with the same consumer index.
+	 * The item is copied, it stays in the queue for the other consumers.
+	 * 
+	 * @param consumer Consumer index from addConsumer().
+	 * @param item Item, where the popped item will be copied.
+	 * @return True, when success. False, when the consumer popped all items and signalNoMorePush() was called.
+	 */
+	bool pop(boost::uint32_t consumer, T &item){
+		BOOST_ASSERT(consumer < mCount);
+		cursor &self = mConsumers[consumer];
+		boost::uint32_t mypos;
+		if(!claimPopSlot(self, mypos))
+			return false;
+		item = *mSlots[mypos % size].get();
+		freePopSlot(self, mypos + 1);
+		return true;
+	}
+
+	/*! \brief Pop the next item of the consumer, when there is one.
+	 * 
+	 * Only one thread may pop with the same consumer index.
+	 * 
+	 * @param consumer Consumer index from addConsumer().
+	 * @param item Item, where the popped item will be copied.
+	 * @return True, when success. False, when the consumer popped all items.
+	 */
+	bool tryPop(boost::uint32_t consumer, T &item){
+		BOOST_ASSERT(consumer < mCount);
+		cursor &self = mConsumers[consumer];
+		boost::uint32_t mypos = self.value.readPos.loadRelaxed();
+		if(isEmptyAt(self, mypos))
+			return false;
+		item = *mSlots[mypos % size].get();
+		freePopSlot(self, mypos + 1);
+		return true;
+	}
+
+	/*! \brief Pop the next items of the consumer.
+	 * 
+	 * Only one thread may pop with the same consumer index.
+	 * It waits for data, and copies the items availible (maximum count), the read position is written once.
+	 * 
+	 * @param consumer Consumer index from addConsumer().
+	 * @param out Output iterator, where the popped items will be copied.
+	 * @param count Maximum number of items to pop.
+	 * @return Number of popped items. Zero, when the consumer popped all items and signalNoMorePush() was called.
+	 */
+	template <class OutputIt>
+	std::size_t pop(boost::uint32_t consumer, OutputIt out, std::size_t count){
+		BOOST_ASSERT(consumer < mCount);
+		boost::uint32_t mypos;
+		if(count == 0 || !claimPopSlot(mConsumers[consumer], mypos))
+			return 0;
+		return tryPop(consumer, out, count);
+	}
+
+	/*! \brief Pop the next items of the consumer, when there are any.
+	 * 
+	 * Only one thread may pop with the same consumer index.
+	 * The write position is read at most once, and the read position is written once for all items.
+	 * 
+	 * @param consumer Consumer index from addConsumer().
+	 * @param out Output iterator, where the popped items will be copied.
+	 * @param count Maximum number of items to pop.
+	 * @return Number of popped items. Zero, when the consumer popped all items.
+	 */
+	template <class OutputIt>
+	std::size_t tryPop(boost::uint32_t consumer, OutputIt out, std::size_t count){
+		BOOST_ASSERT(consumer < mCount);
+		cursor &self = mConsumers[consumer];
+		boost::uint32_t pos = self.value.readPos.loadRelaxed();
+		if(isEmptyAt(self, pos))
+			return 0;
+		boost::uint32_t ready = self.value.cachedWritePos - pos;
+		if(count < ready)
+			ready = (boost::uint32_t)count;
+		for(boost::uint32_t i = 0; i < ready; i++, pos++, ++out){
+			*out = *mSlots[pos % size].get();
+		}
+		freePopSlot(self, pos);
+		return ready;
+	}
+
+	/*! \brief Close the queue for pushing.
+	 * 
+	 * When you don't want to push any more data, you can call this, and the consumers will return, when they popped all items.
+	 * 
+	 */
+	void signalNoMorePush(){
+		mNoMorePush.storeRelease(true);
+		mParking.notify();
+	}
+
+	/*! \brief Empty the queue and open it for pushing again.
+	 * 
+	 * Not thread-safe, no other thread may use the queue meanwhile.
+	 * The items are destroyed and signalNoMorePush() is cleared.
+	 * The consumer indices stay valid, the removed consumers are active again.
+	 * 
+	 */
+	void reset(){
+		destroyItems();
+		mProducer.value.writePos.storeRelaxed(0);
+		mProducer.value.cachedReadPos = 0;
+		mProducer.value.filled = 0;
+		for(boost::uint32_t i = 0; i < mCount; i++){
+			mConsumers[i].value.readPos.storeRelaxed(0);
+			mConsumers[i].value.cachedWritePos = 0;
+			mConsumers[i].value.active.storeRelaxed(true);
+		}
+		mNoMorePush.storeRelease(false);
+	}
+
+	/*! \brief Gets the number of items, which the consumer didn't pop yet.
+	 * 
+	 * It is exact, when called from the pushing thread or the popping thread of the consumer.
+	 * 
+	 * @param consumer Consumer index.
+	 */
+	int getQueueLength(boost::uint32_t consumer){
+		BOOST_ASSERT(consumer < mCount);
+		return (int)(mProducer.value.writePos.loadAcquire() - mConsumers[consumer].value.readPos.loadAcquire());
+	}
+
+	/*! \brief Checks, if the consumer popped all items.
+	 * 
+	 * @param consumer Consumer index.
+	 */
+	bool isEmpty(boost::uint32_t consumer){
+		BOOST_ASSERT(consumer < mCount);
+		return mProducer.value.writePos.loadAcquire() == mConsumers[consumer].value.readPos.loadAcquire();
+	}
+
+	/*! \brief Gets the number of consumers.
+	 */
+	boost::uint32_t getConsumerCount() const {
+		return mCount;
+	}
+
+	/*! \brief Gets the number of slots in the queue.
+	 */
+	boost::uint32_t getCapacity() const {
+		return size;
+	}
+private:
+	broadcast_circular_queue(const broadcast_circular_queue&);
+	broadcast_circular_queue& operator=(const broadcast_circular_queue&);
+
+	struct producer {
+		circular_queue_detail::atomic<boost::uint32_t> writePos; // push position, written by the producer
+		boost::uint32_t cachedReadPos; // last seen read position of the slowest consumer, used only by the producer
+		boost::uint32_t filled; // number of slots with an item, used only by the producer
+	};
+	struct consumer {
+		circular_queue_detail::atomic<boost::uint32_t> readPos; // pop position, written by the consumer
+		boost::uint32_t cachedWritePos; // last seen push position, used only by the consumer
+		circular_queue_detail::atomic<bool> active; // false after removeConsumer()
+	};
+	typedef circular_queue_detail::layout_cell<consumer, padded_layout> cursor;
+
+	//the slots keep the items, until the producer overwrites them.
+	void destroyItems(){
+		boost::uint32_t end = mProducer.value.writePos.loadRelaxed();
+		for(boost::uint32_t pos = end - mProducer.value.filled; pos != end; pos++){
+			mSlots[pos % size].get()->~T();
+		}
+	}
+
+	//checks the cached read position first, the consumers are only read, when it looks full.
+	bool isFullAt(boost::uint32_t mypos){
+		if(mypos - mProducer.value.cachedReadPos != size)
+			return false;
+		mProducer.value.cachedReadPos = slowestReadPos(mypos);
+		return mypos - mProducer.value.cachedReadPos == size;
+	}
+	//read position of the consumer, which is the most behind mypos.
+	boost::uint32_t slowestReadPos(boost::uint32_t mypos){
+		boost::uint32_t lag = 0;
+		for(boost::uint32_t i = 0; i < mCount; i++){
+			consumer &current = mConsumers[i].value;
+			if(!current.active.loadAcquire())
+				continue;
+			boost::uint32_t behind = mypos - current.readPos.loadAcquire();
+			if(behind > lag)
+				lag = behind;
+		}
+		return mypos - lag;
+	}
+	//checks the cached write position first, the shared one is only read, when it looks empty.
+	bool isEmptyAt(cursor &self, boost::uint32_t mypos){
+		if(mypos != self.value.cachedWritePos)
+			return false;
+		self.value.cachedWritePos = mProducer.value.writePos.loadAcquire();
+		return mypos == self.value.cachedWritePos;
+	}
+	boost::uint32_t claimPushSlot(){
+		BOOST_ASSERT(!mNoMorePush.loadRelaxed());
+		boost::uint32_t mypos = mProducer.value.writePos.loadRelaxed();
+		if(isFullAt(mypos)){
+			Wait waiter(mParking);
+			//queue is full, wait for the slowest consumer.
+			while(isFullAt(mypos)){
+				waiter.wait();
+			}
+		}
+		freeSlot(mypos);
+		return mypos;
+	}
+	//destroys the item of the previous round, all consumers are done with it.
+	//the slot is not counted, until the new item is constructed, so a throwing constructor leaves it empty.
+	void freeSlot(boost::uint32_t mypos){
+		if(mProducer.value.filled == size){
+			mSlots[mypos % size].get()->~T();
+			mProducer.value.filled--;
+		}
+	}
+	void publishPushSlot(boost::uint32_t mypos){
+		mProducer.value.filled++;
+		mProducer.value.writePos.storeRelease(mypos + 1);
+		mParking.notify();
+	}
+	bool claimPopSlot(cursor &self, boost::uint32_t &mypos){
+		mypos = self.value.readPos.loadRelaxed();
+		if(isEmptyAt(self, mypos)){
+			Wait waiter(mParking);
+			//no new item, wait for data.
+			while(isEmptyAt(self, mypos)){
+				if(mNoMorePush.loadAcquire())
+					return !isEmptyAt(self, mypos);
+				waiter.wait();
+			}
+		}
+		return true;
+	}
+	void freePopSlot(cursor &self, boost::uint32_t next){
+		self.value.readPos.storeRelease(next);
+		mParking.notify();
+	}
+
+	circular_queue_detail::layout_cell<producer, padded_layout> mProducer;
+	cursor *mConsumers; // one for every consumer, on its own cache line
+	const boost::uint32_t mCount; // number of consumers
+	circular_queue_detail::atomic<boost::uint32_t> mNextConsumer; // used by addConsumer()
+	circular_queue_detail::slot_storage<T> mSlots[size];
+	circular_queue_detail::atomic<bool> mNoMorePush;
+	typename Wait::parking mParking; //wakes up sleeping threads for park_wait
+};
+
+#endif //BROADCAST_CIRCULAR_QUEUE_H
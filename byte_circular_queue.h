@@ -0,0 +1,324 @@
+/**
+ * @file
+ * @author Peter Szucs <peter.szucs.dev@gmail.com>
+ *
+ * @section LICENSE
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @class byte_circular_queue
+ * \brief Multi-producer/single-consumer ring of variable length records.
+ * 
+ * Use this for messages with different sizes, small messages are packed next to each other,
+ * so there is no padding to the biggest message and no allocation per message.
+ * Every record has an 8 byte header (state and length) and it is rounded up to 8 bytes.
+ * The pushing threads take the bytes for the record with a single atomic operation on the write position,
+ * like the positions of circular_queue. A record is always contiguous in the buffer:
+ * when it would wrap around, a padding record is written to the end of the buffer, which is skipped by the consumer.
+ * Every header is published with the position of its record, so the consumer won't take the bytes of a previous round
+ * for a new header. The consumer frees the records in order, and clears only their headers, the payload is not touched again.
+ *
+ * example:
+ * 	byte_circular_queue<65536> ring;
+ * 	ring.push(&msg, sizeof(msg)); //producers
+ * 	boost::uint32_t length;
+ * 	while(const void *data = ring.peekPop(length)){ handle(data, length); ring.releasePop(); } //consumer
+ */
+
+#ifndef BYTE_CIRCULAR_QUEUE_H
+#define BYTE_CIRCULAR_QUEUE_H
+
+#include "circular_queue.h"
+#include <cstring> //memcpy(), memset()
+
+/*! \brief The variable length record ring.
+ * 
+ * @tparam size Number of bytes in the buffer, needs to be power of two.
+ * @tparam Wait Wait strategy: default_wait, spin_wait, spin_yield_wait, backoff_wait, spin_sleep_wait or park_wait.
+ */
+template <boost::uint32_t size = 65536u, typename Wait = default_wait>
+class byte_circular_queue {
+public:
+	byte_circular_queue()
+	{
+		// 0x100000000 needs to be dividable by size or it will fail on overflow.
+		BOOST_STATIC_ASSERT( (0xFFFFFFFFu % size) == (size - 1) );
+		BOOST_STATIC_ASSERT( size >= 4 * sizeof(record_header) );
+		//the headers are not constructed objects, the atomics are used in place in the buffer at any 8 byte offset.
+		//it needs address-free, lock-free 32 bit atomics without extra state, which is true on all common platforms.
+		BOOST_STATIC_ASSERT( sizeof(circular_queue_detail::atomic<boost::uint32_t>) == sizeof(boost::uint32_t) );
+		//empty headers are zero.
+		std::memset(&mBuffer, 0, size);
+	}
+
+	/*! \brief Reserve contiguous bytes for a record, to write it in place.
+	 * 
+	 * Thread-safe push in two steps, it waits for free space.
+	 * Write the record to the returned memory (e.g. recv() into it), then call commitPush().
+	 * The consumer will wait for this record, so don't hold it for long.
+	 * 
+	 * @param length Number of bytes, maximum is getMaxLength().
+	 * @param record Set to the reserved record, pass it to commitPush().
+	 * @return Pointer to the payload of the record, it is 8 byte aligned.
+	 */
+	void* reservePush(boost::uint32_t length, boost::uint32_t &record){
+		BOOST_ASSERT(length <= getMaxLength());
+		record = claimPushSpan(recordBytes(length));
+		return startRecord(record, length);
+	}
+
+	/*! \brief Reserve contiguous bytes for a record, when there is enough free space.
+	 * 
+	 * Same as reservePush(), but it doesn't wait.
+	 * 
+	 * @param length Number of bytes, maximum is getMaxLength().
+	 * @param record Set to the reserved record, pass it to commitPush().
+	 * @return Pointer to the payload of the record. NULL, when there is not enough free space.
+	 */
+	void* tryReservePush(boost::uint32_t length, boost::uint32_t &record){
+		BOOST_ASSERT(length <= getMaxLength());
+		if(!tryClaimPushSpan(recordBytes(length), record))
+			return NULL;
+		return startRecord(record, length);
+	}
+
+	/*! \brief Publish the record got from reservePush() or tryReservePush().
+	 * 
+	 * @param record The record from reservePush().
+	 */
+	void commitPush(boost::uint32_t record){
+		record_header *myheader = header(record);
+		myheader->state.storeRelease(record | dataFlag);
+		mParking.notify();
+	}
+
+	/*! \brief Push a record.
+	 * 
+	 * Thread-safe push, it waits for free space.
+	 * 
+	 * @param data Bytes of the record.
+	 * @param length Number of bytes, maximum is getMaxLength().
+	 */
+	void push(const void *data, boost::uint32_t length){
+		boost::uint32_t record;
+		std::memcpy(reservePush(length, record), data, length);
+		commitPush(record);
+	}
+
+	/*! \brief Push a record, when there is enough free space.
+	 * 
+	 * Thread-safe push, it can be mixed with push().
+	 * 
+	 * @param data Bytes of the record.
+	 * @param length Number of bytes, maximum is getMaxLength().
+	 * @return True, when the record is pushed. False, when there is not enough free space.
+	 */
+	bool tryPush(const void *data, boost::uint32_t length){
+		boost::uint32_t record;
+		void *payload = tryReservePush(length, record);
+		if(!payload)
+			return false;
+		std::memcpy(payload, data, length);
+		commitPush(record);
+		return true;
+	}
+
+	/*! \brief Get the next record in place.
+	 * 
+	 * Only one thread may pop. It waits for data, the record stays in the buffer, until releasePop() is called.
+	 * 
+	 * @param length Set to the number of bytes in the record.
+	 * @return Pointer to the payload of the record. NULL, when queue is empty and signalNoMorePush() was called.
+	 */
+	const void* peekPop(boost::uint32_t &length){
+		return claimPopRecord(length, true);
+	}
+
+	/*! \brief Get the next record in place, when there is one.
+	 * 
+	 * Same as peekPop(), but it doesn't wait.
+	 * 
+	 * @param length Set to the number of bytes in the record.
+	 * @return Pointer to the payload of the record. NULL, when queue is empty.
+	 */
+	const void* tryPeekPop(boost::uint32_t &length){
+		return claimPopRecord(length, false);
+	}
+
+	/*! \brief Free the record got from peekPop() or tryPeekPop().
+	 */
+	void releasePop(){
+		boost::uint32_t pos = mReadPos.value.loadRelaxed();
+		record_header *myheader = header(pos);
+		boost::uint32_t bytes = recordBytes(myheader->length);
+		//only the header is cleared, the headers of the next round are checked by their position, see claimPopRecord().
+		myheader->state.storeRelaxed(0);
+		mReadPos.value.storeRelease(pos + bytes);
+		mParking.notify();
+	}
+
+	/*! \brief Close the queue for pushing.
+	 * 
+	 * When you don't want to push any more data, you can call this, and the consumer will return, when the queue is empty.
+	 * Records, which are reserved before this call, are still waited for, so they need to be committed.
+	 * 
+	 */
+	void signalNoMorePush(){
+		mNoMorePush.storeRelease(true);
+		mParking.notify();
+	}
+
+	/*! \brief Empty the queue and open it for pushing again.
+	 * 
+	 * Not thread-safe, no other thread may use the queue meanwhile.
+	 * The records are dropped, the positions are set back to zero and signalNoMorePush() is cleared.
+	 * 
+	 */
+	void reset(){
+		std::memset(&mBuffer, 0, size);
+		mWritePos.value.storeRelaxed(0);
+		mReadPos.value.storeRelaxed(0);
+		mNoMorePush.storeRelease(false);
+	}
+
+	/*! \brief Gets the estimated number of used bytes, with headers and padding.
+	 */
+	boost::uint32_t getUsedBytes(){
+		return mWritePos.value.loadRelaxed() - mReadPos.value.loadRelaxed();
+	}
+
+	/*! \brief Gets the number of bytes in the buffer.
+	 */
+	boost::uint32_t getCapacity() const {
+		return size;
+	}
+
+	/*! \brief Gets the maximum length of a record.
+	 * 
+	 * A record can use half of the buffer, so after a padding, the next try will fit.
+	 */
+	static boost::uint32_t getMaxLength(){
+		return size / 2 - sizeof(record_header);
+	}
+private:
+	byte_circular_queue(const byte_circular_queue&);
+	byte_circular_queue& operator=(const byte_circular_queue&);
+
+	/* state is the position of the record with the flags, when it is published.
+	 * Anything else (0 after the consumer, or old bytes of the previous round) means not written yet.
+	 * length is the number of payload bytes, it is written before state is published.
+	 */
+	struct record_header {
+		circular_queue_detail::atomic<boost::uint32_t> state;
+		boost::uint32_t length;
+	};
+	static const boost::uint32_t dataFlag = 1u;
+	static const boost::uint32_t paddingFlag = 2u;
+	static const boost::uint32_t flagMask = 7u;
+
+	static boost::uint32_t recordBytes(boost::uint32_t length){
+		return (boost::uint32_t)(sizeof(record_header) + length + flagMask) & ~flagMask;
+	}
+	//the buffer is zeroed, so the headers are valid atomics with 0 value.
+	record_header* header(boost::uint32_t pos){
+		return reinterpret_cast<record_header*>(reinterpret_cast<char*>(&mBuffer) + (pos & (size - 1)));
+	}
+	void* startRecord(boost::uint32_t pos, boost::uint32_t length){
+		record_header *myheader = header(pos);
+		myheader->length = length;
+		return myheader + 1;
+	}
+	//consumer skips the end of the buffer.
+	void pushPadding(boost::uint32_t pos, boost::uint32_t bytes){
+		record_header *myheader = header(pos);
+		myheader->length = bytes - (boost::uint32_t)sizeof(record_header);
+		myheader->state.storeRelease(pos | paddingFlag);
+		mParking.notify();
+	}
+
+	boost::uint32_t claimPushSpan(boost::uint32_t bytes){
+		BOOST_ASSERT(!mNoMorePush.loadRelaxed());
+		Wait waiter(mParking);
+		for(;;){
+			boost::uint32_t pos = mWritePos.value.fetchAdd(bytes);
+			//queue is full, wait for the consumer.
+			while(pos + bytes - mReadPos.value.loadAcquire() > size){
+				waiter.wait();
+			}
+			if((pos & (size - 1)) + bytes <= size)
+				return pos;
+			//the record would wrap around, our bytes are padding, take new ones.
+			pushPadding(pos, bytes);
+		}
+	}
+	bool tryClaimPushSpan(boost::uint32_t bytes, boost::uint32_t &pos){
+		BOOST_ASSERT(!mNoMorePush.loadRelaxed());
+		pos = mWritePos.value.loadRelaxed();
+		for(;;){
+			boost::uint32_t offset = pos & (size - 1);
+			//the record would wrap around, the end of the buffer is taken as padding first.
+			boost::uint32_t span = offset + bytes > size ? size - offset : bytes;
+			if(pos + span - mReadPos.value.loadAcquire() > size)
+				return false;
+			if(!mWritePos.value.compareExchange(pos, pos + span))
+				continue;
+			if(span == bytes)
+				return true;
+			pushPadding(pos, span);
+			pos += span;
+		}
+	}
+	const void* claimPopRecord(boost::uint32_t &length, bool wait){
+		Wait waiter(mParking);
+		for(;;){
+			boost::uint32_t pos = mReadPos.value.loadRelaxed();
+			record_header *myheader = header(pos);
+			//the header is published only, when it has our position, the positions are 8 byte aligned.
+			boost::uint32_t state = myheader->state.loadAcquire();
+			if(state == (pos | dataFlag)){
+				length = myheader->length;
+				return myheader + 1;
+			} else if(state == (pos | paddingFlag)){
+				myheader->state.storeRelaxed(0);
+				mReadPos.value.storeRelease(pos + recordBytes(myheader->length));
+				mParking.notify();
+			} else if(!wait || isDrainedAt(pos)){
+				return NULL;
+			} else {
+				//queue is empty, wait for data.
+				waiter.wait();
+			}
+		}
+	}
+	//true, when signalNoMorePush() was called and no push has taken bytes from pos, so no record will come.
+	//a record, which is reserved before signalNoMorePush(), is still waited for.
+	bool isDrainedAt(boost::uint32_t pos){
+		if(!mNoMorePush.loadAcquire())
+			return false;
+		return mWritePos.value.loadAcquire() == pos;
+	}
+
+	typename boost::aligned_storage<size, CIRCULAR_QUEUE_CACHE_LINE_SIZE>::type mBuffer; // records
+	circular_queue_detail::layout_cell<circular_queue_detail::atomic<boost::uint32_t>, padded_layout> mWritePos; // push position in bytes
+	circular_queue_detail::layout_cell<circular_queue_detail::atomic<boost::uint32_t>, padded_layout> mReadPos; // pop position in bytes
+	circular_queue_detail::atomic<bool> mNoMorePush;
+	typename Wait::parking mParking; //wakes up sleeping threads for park_wait
+};
+
+#endif //BYTE_CIRCULAR_QUEUE_H
@@ -53,25 +53,73 @@
 
 // you will need to install boost: http://www.boost.org
 #include <boost/cstdint.hpp> //uint32_t
-#include <boost/interprocess/detail/atomic.hpp> //atomic_inc32()
+#include <boost/config.hpp> //BOOST_NO_CXX11_HDR_ATOMIC
+#include <boost/version.hpp> //BOOST_VERSION
 #include <boost/thread.hpp> //yield()
+#include <boost/chrono.hpp> //steady_clock, link boost_chrono for pushFor() and popFor()
 #include <boost/exception/exception.hpp> //exception()
+#include <cstddef> //size_t
+#include <iterator> //distance()
+#include <new> //placement new, bad_alloc
+#include <boost/move/utility_core.hpp> //move()
+#include <boost/type_traits/aligned_storage.hpp>
+#include <boost/type_traits/alignment_of.hpp>
+#include <boost/type_traits/integral_constant.hpp> //true_type, false_type
+#include <boost/type_traits/has_trivial_copy.hpp>
+#include <boost/type_traits/has_trivial_assign.hpp>
+#include <boost/type_traits/has_trivial_destructor.hpp>
+#include <cstring> //memcpy()
 
 /*********/
 /* Setup */
 /*********/
 #ifdef _DEBUG
-	// Will write to cout every push and pop operation.
+	// Will write to cout every push and pop operation, it selects cout_trace.
 	//#define CIRCULAR_QUEUE_VERBOSE
 	// This will check in destructor, that the queue is empty.
 	//#define CIRCULAR_QUEUE_SAFE_DELETE
 #endif
-// When you only use pushUnsafe(), you can disable push() to save memory.
-//#define CIRCULAR_QUEUE_DISABLE_SAFE_PUSH
-// When you only use popUnsafe(), you can disable pop() to save memory.
-//#define CIRCULAR_QUEUE_DISABLE_SAFE_POP
+// CIRCULAR_QUEUE_DISABLE_SAFE_PUSH and CIRCULAR_QUEUE_DISABLE_SAFE_POP are replaced by the Concurrency template parameter.
+// With mpsc, spmc or spsc the tickets of the single-threaded side are not compiled in.
 
-// This is called, when the thread needs to wait
+// Use volatile and boost::interprocess atomics, even when std::atomic is availible.
+//#define CIRCULAR_QUEUE_LEGACY_ATOMIC
+
+// The width of the push and pop positions is selected by the Position template parameter, see position64.
+
+// The wait counters are selected by the Stats template parameter, see sharded_stats.
+
+// Tracing of the push, pop, wait and close events, see circular_queue_event.
+// Record them in per-thread rings, read them with ring_trace::forEach() or ring_trace::writeChromeTrace().
+//#define CIRCULAR_QUEUE_TRACE_RING
+// Or emit USDT probes (provider circular_queue), for perf, bpftrace or SystemTap. Needs <sys/sdt.h>.
+//#define CIRCULAR_QUEUE_USDT
+// Or use your own tracer, a class with the static function of ring_trace::event(), declared before this header.
+//#define CIRCULAR_QUEUE_TRACE my_tracer
+// Without these, the hooks are compiled out.
+
+// Number of records per thread for ring_trace, the oldest are overwritten.
+#ifndef CIRCULAR_QUEUE_TRACE_RING_SIZE
+	#define CIRCULAR_QUEUE_TRACE_RING_SIZE 4096
+#endif
+
+// park_wait will use condition variable, even when futex or WaitOnAddress is availible.
+//#define CIRCULAR_QUEUE_NO_FUTEX
+
+// memory_placement will use aligned_alloc only, without mmap() and mbind() on Linux.
+//#define CIRCULAR_QUEUE_NO_NUMA
+
+// The batch push of trivially copyable items writes the slots with non-temporal stores (SSE2) on x86, bypassing the cache.
+// Use it, when the batches are big and the consumer reads them later, so they would only evict the producer's cache.
+//#define CIRCULAR_QUEUE_STREAMING_STORES
+
+// Cache line size used by padded_layout.
+#ifndef CIRCULAR_QUEUE_CACHE_LINE_SIZE
+	#define CIRCULAR_QUEUE_CACHE_LINE_SIZE 64
+#endif
+
+// This is called by default_wait, when the thread needs to wait.
+// You can select other wait strategy for each queue with the Wait template parameter.
 #ifndef CIRCULAR_QUEUE_WAIT
 	// yield will add CPU to other thread, but wont go sleep for fixed time.
 	// yield is not good for long living queues.
@@ -82,52 +130,1139 @@
 
 // End of Setup
 
+#if !defined(CIRCULAR_QUEUE_LEGACY_ATOMIC) && !defined(BOOST_NO_CXX11_HDR_ATOMIC)
+	#define CIRCULAR_QUEUE_STD_ATOMIC
+	#include <atomic>
+#else
+	#include <boost/interprocess/detail/atomic.hpp> //atomic_inc32()
+#endif
+
+#if defined(CIRCULAR_QUEUE_STD_ATOMIC) && defined(BOOST_NO_CXX11_THREAD_LOCAL)
+	#include <boost/functional/hash.hpp> //hash of thread id for sharded_stats
+#endif
+
+#if defined(_MSC_VER)
+	#include <intrin.h> //_mm_pause(), _mm_stream_si128(), _InterlockedExchange()
+#elif defined(__i386__) || defined(__x86_64__)
+	#include <immintrin.h> //_mm_pause(), _mm_stream_si128()
+#endif
+
+#if !defined(CIRCULAR_QUEUE_NO_FUTEX) && defined(__linux__)
+	#define CIRCULAR_QUEUE_FUTEX
+	#include <climits> //INT_MAX
+	#include <linux/futex.h>
+	#include <sys/syscall.h>
+	#include <time.h>
+	#include <unistd.h>
+#elif !defined(CIRCULAR_QUEUE_NO_FUTEX) && defined(_WIN32) && defined(_WIN32_WINNT) && _WIN32_WINNT >= 0x0602
+	#define CIRCULAR_QUEUE_WAIT_ON_ADDRESS
+	#include <windows.h> //WaitOnAddress()
+	#pragma comment(lib, "Synchronization.lib")
+#endif
+
+#if !defined(CIRCULAR_QUEUE_NO_NUMA) && defined(__linux__)
+	#define CIRCULAR_QUEUE_NUMA
+	#include <sys/mman.h> //mmap(), madvise()
+	#include <sys/syscall.h> //SYS_mbind, SYS_getcpu
+	#include <unistd.h>
+#endif
+#include <boost/align/aligned_alloc.hpp> //aligned_alloc()
+
+#ifndef CIRCULAR_QUEUE_TRACE
+	#if defined(CIRCULAR_QUEUE_USDT)
+		#define CIRCULAR_QUEUE_TRACE usdt_trace
+	#elif defined(CIRCULAR_QUEUE_TRACE_RING)
+		#define CIRCULAR_QUEUE_TRACE ring_trace
+	#elif defined(CIRCULAR_QUEUE_VERBOSE)
+		#define CIRCULAR_QUEUE_TRACE cout_trace
+	#endif
+#endif
+#ifdef CIRCULAR_QUEUE_USDT
+	#include <sys/sdt.h> //DTRACE_PROBE4()
+#endif
+#ifdef CIRCULAR_QUEUE_TRACE_RING
+	#if !defined(CIRCULAR_QUEUE_STD_ATOMIC) || defined(BOOST_NO_CXX11_THREAD_LOCAL)
+		#error CIRCULAR_QUEUE_TRACE_RING needs std::atomic and thread_local.
+	#endif
+	#include <ostream> //writeChromeTrace()
+#endif
 #ifdef CIRCULAR_QUEUE_VERBOSE
-	#include <iostream>
-	#include <boost/interprocess/sync/interprocess_mutex.hpp>
-	boost::interprocess::interprocess_mutex cout_mutex;
-	#define COUT_WRITE(msg) { cout_mutex.lock(); std::cout << msg; cout_mutex.unlock();}
+	#include <iostream> //cout
 #endif
 
 //! Exception, throwed in pop() and popUnsafe(), when queue is empty and after signalNoMorePush() is called.
 struct exNoMorePush : virtual boost::exception { };
 
+/*! \brief Events of the queue for the tracers and for sharded_stats.
+ * 
+ * The waits are reported at every wait() of the wait strategy, the others once per operation.
+ */
+struct circular_queue_event {
+	enum type {
+		pushTicketWait, //!< push() waits for an other pushing thread on the same slot
+		popTicketWait, //!< pop() waits for an other popping thread on the same slot
+		fullWait, //!< push() waits in a full queue
+		emptyWait, //!< pop() waits in an empty queue
+		noMorePushExit, //!< pop returned without data after signalNoMorePush()
+		push, //!< push has taken count positions from pos
+		pop, //!< pop has taken count positions from pos
+		close, //!< signalNoMorePush() at write position pos
+		typeCount
+	};
+	//! Name of the event, e.g. "fullWait".
+	static const char* name(type event){
+		static const char *names[typeCount] = {
+			"pushTicketWait", "popTicketWait", "fullWait", "emptyWait", "noMorePushExit", "push", "pop", "close"
+		};
+		return event < typeCount ? names[event] : "unknown";
+	}
+};
+
+/*! \brief Snapshot of the wait counters of a queue, see sharded_stats.
+ * 
+ * The counters are summed from the shards without locking, so a snapshot taken while the queue is used
+ * may be a bit behind, but every counter only grows.
+ */
+struct circular_queue_stats {
+	boost::uint64_t pushTicketWaits; //!< waits of push() for an other pushing thread on the same slot
+	boost::uint64_t popTicketWaits; //!< waits of pop() for an other popping thread on the same slot
+	boost::uint64_t fullWaits; //!< waits of push() in a full queue
+	boost::uint64_t emptyWaits; //!< waits of pop() in an empty queue
+	boost::uint64_t noMorePushExits; //!< pops, which returned without data after signalNoMorePush()
+	boost::uint64_t highWater; //!< highest length seen by a push, bigger than the capacity when pushes waited in a full queue
+};
 
+/*! \brief NUMA node and page size of the heap memory of a queue.
+ * 
+ * Used by dynamic_circular_queue, sharded_circular_queue and work_stealing_pool.
+ * A circular_queue can be constructed with placement new in memory from allocate().
+ * On Linux the memory is mapped with mmap(), and bound to the node with mbind(), the pages are taken from the node at first touch.
+ * Huge pages are taken from hugetlbfs, when there are reserved ones, otherwise transparent huge pages are requested with madvise().
+ * It is only a hint, when the node or the huge pages are not availible, the memory comes from any node.
+ * On other systems, or with CIRCULAR_QUEUE_NO_NUMA, it is aligned_alloc().
+ */
+struct memory_placement {
+	static const int anyNode = -1; //!< no binding, the memory is allocated by the first touching thread
+	int node; //!< NUMA node of the memory, or anyNode
+	bool hugePages; //!< use 2 MiB pages, the size is rounded up to it
 
-template <typename T, boost::uint32_t size = 32u>
-class circular_queue {
-public:
-	circular_queue() :
-		mWritePos(0),
-		mReadPos(0),
-		mNoMorePush(false)
-	{
-		for(boost::uint32_t i = 0; i < size; i++){
-			mHasData[i] = false;
-			#ifndef CIRCULAR_QUEUE_DISABLE_SAFE_PUSH
-				mPushQueue[i] = 0;
-				mPushTicket[i] = 0;
+	memory_placement() : node(anyNode), hugePages(false) { }
+	explicit memory_placement(int numaNode, bool huge = false) : node(numaNode), hugePages(huge) { }
+
+	//! NUMA node of the CPU, where the calling thread runs, or anyNode when it's unknown.
+	static int currentNode(){
+	#ifdef CIRCULAR_QUEUE_NUMA
+		unsigned cpu, node;
+		if(syscall(SYS_getcpu, &cpu, &node, NULL) == 0)
+			return (int)node;
+	#endif
+		return anyNode;
+	}
+
+	/*! \brief Allocates the memory, throws bad_alloc on failure.
+	 * 
+	 * @param bytes Size of the memory.
+	 * @param alignment Alignment, maximum the page size, when mmap() is used.
+	 */
+	void* allocate(std::size_t bytes, std::size_t alignment) const {
+	#ifdef CIRCULAR_QUEUE_NUMA
+		if(isMapped()){
+			BOOST_ASSERT(alignment <= (std::size_t)sysconf(_SC_PAGESIZE));
+			std::size_t length = mappedLength(bytes);
+			void *memory = MAP_FAILED;
+			if(hugePages)
+				memory = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+			if(memory == MAP_FAILED){
+				memory = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+				if(memory == MAP_FAILED)
+					throw std::bad_alloc();
+			#ifdef MADV_HUGEPAGE
+				if(hugePages)
+					madvise(memory, length, MADV_HUGEPAGE);
 			#endif
-			#ifndef CIRCULAR_QUEUE_DISABLE_SAFE_POP
-				mPopQueue[i] = 0;
-				mPopTicket[i] = 0;
+			}
+			if(node >= 0 && node < maxNodes){
+				//MPOL_PREFERRED, so it falls back to other nodes, when this one is full.
+				const int preferred = 1;
+				unsigned long mask[maxNodes / (8 * sizeof(unsigned long))] = { 0 };
+				mask[node / (8 * sizeof(unsigned long))] = 1ul << (node % (8 * sizeof(unsigned long)));
+				syscall(SYS_mbind, memory, length, preferred, mask, (unsigned long)maxNodes + 1, 0u);
+			}
+			return memory;
+		}
+	#endif
+		void *memory = boost::alignment::aligned_alloc(alignment, bytes);
+		if(!memory)
+			throw std::bad_alloc();
+		return memory;
+	}
+
+	/*! \brief Frees the memory of allocate().
+	 * 
+	 * @param memory Returned by allocate() of the same placement.
+	 * @param bytes Same as in allocate().
+	 */
+	void deallocate(void *memory, std::size_t bytes) const {
+	#ifdef CIRCULAR_QUEUE_NUMA
+		if(isMapped()){
+			munmap(memory, mappedLength(bytes));
+			return;
+		}
+	#endif
+		(void)bytes;
+		boost::alignment::aligned_free(memory);
+	}
+private:
+#ifdef CIRCULAR_QUEUE_NUMA
+	static const int maxNodes = 1024;
+
+	//the default placement stays on the heap, small allocations would waste a page.
+	bool isMapped() const { return node != anyNode || hugePages; }
+	std::size_t mappedLength(std::size_t bytes) const {
+		std::size_t page = hugePages ? (std::size_t)2 << 20 : (std::size_t)sysconf(_SC_PAGESIZE);
+		return (bytes + page - 1) & ~(page - 1);
+	}
+#endif
+};
+
+
+
+/*! \brief Layout policy: slot data, flags and tickets are stored in separate packed arrays.
+ * 
+ * This is the default, it has the lowest memory usage.
+ */
+struct packed_layout { };
+
+/*! \brief Layout policy: every slot and the read/write positions are placed on their own cache line.
+ * 
+ * Each slot's data, flag and tickets are in one cache line aligned struct,
+ * so threads working on neighbour slots won't invalidate each others cache line (false sharing).
+ * Use this for heavily contended queues. It needs CIRCULAR_QUEUE_CACHE_LINE_SIZE bytes per slot at least.
+ * Note: operator new will only respect the alignment since C++17.
+ */
+struct padded_layout { };
+
+/*! \brief Concurrency policy: multiple pushing and multiple popping threads.
+ * 
+ * This is the default, push() and pop() use the ticket system on both sides.
+ */
+struct mpmc {
+	static const bool multiProducer = true;
+	static const bool multiConsumer = true;
+};
+
+/*! \brief Concurrency policy: multiple pushing threads and a single popping thread. (collect data)
+ * 
+ * pop() works like popUnsafe(), the pop tickets are not stored.
+ */
+struct mpsc {
+	static const bool multiProducer = true;
+	static const bool multiConsumer = false;
+};
+
+/*! \brief Concurrency policy: a single pushing thread and multiple popping threads. (add tasks for workers)
+ * 
+ * push() works like pushUnsafe(), the push tickets are not stored.
+ */
+struct spmc {
+	static const bool multiProducer = false;
+	static const bool multiConsumer = true;
+};
+
+/*! \brief Concurrency policy: a single pushing and a single popping thread.
+ * 
+ * No tickets are stored, only the flags. spsc_circular_queue is usually faster for this,
+ * because it doesn't touch the flags of the slots.
+ */
+struct spsc {
+	static const bool multiProducer = false;
+	static const bool multiConsumer = false;
+};
+
+/*! \brief Position policy: 32 bit push and pop positions.
+ * 
+ * This is the default. The positions wrap at 2^32, so the size of circular_queue needs to be power of two.
+ */
+struct position32 {
+	typedef boost::uint32_t type; //!< push and pop position
+	typedef boost::int32_t diff_type; //!< distance of two positions
+
+	//! True, when the positions wrap correctly with size slots.
+	template <boost::uint32_t size>
+	struct valid_size : boost::integral_constant<bool, size != 0 && (0xFFFFFFFFu % (size ? size : 1u)) == size - 1> { };
+
+	//true, when the ticket of the slot is at the lap of pos.
+	static bool isLap(boost::uint32_t ticket, type pos, boost::uint32_t capacity){
+		return ticket * capacity == (pos & ~(capacity - 1));
+	}
+	//position served by the ticket on the slot of pos, it can be an other lap than pos.
+	static type ticketPos(boost::uint32_t ticket, type pos, boost::uint32_t capacity){
+		return ticket * capacity + (pos & (capacity - 1));
+	}
+};
+
+#ifdef CIRCULAR_QUEUE_STD_ATOMIC
+/*! \brief Position policy: 64 bit push and pop positions.
+ * 
+ * The positions won't wrap in practice, so the size of circular_queue doesn't need to be power of two.
+ * fetch_add is a single instruction on 64 bit CPUs (x86-64, ARM64).
+ * It needs std::atomic, the legacy backend has only 32 bit atomics.
+ */
+struct position64 {
+	typedef boost::uint64_t type; //!< push and pop position
+	typedef boost::int64_t diff_type; //!< distance of two positions
+
+	//! True, when the positions wrap correctly with size slots.
+	template <boost::uint32_t size>
+	struct valid_size : boost::integral_constant<bool, size != 0> { };
+
+	//true, when the ticket of the slot is at the lap of pos. The tickets are 32 bit, they are compared modulo 2^32.
+	static bool isLap(boost::uint32_t ticket, type pos, boost::uint32_t capacity){
+		return ticket == (boost::uint32_t)(pos / capacity);
+	}
+	//position served by the ticket on the slot of pos, it can be an other lap than pos.
+	static type ticketPos(boost::uint32_t ticket, type pos, boost::uint32_t capacity){
+		boost::int32_t laps = (boost::int32_t)(ticket - (boost::uint32_t)(pos / capacity));
+		return pos + (diff_type)laps * capacity;
+	}
+};
+#endif
+
+namespace circular_queue_detail {
+	//tells the CPU, that we are in a spin loop.
+	inline void cpuPause(){
+	#if defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+		_mm_pause();
+	#elif defined(__i386__) || defined(__x86_64__)
+		_mm_pause();
+	#elif defined(__aarch64__) || defined(__arm__)
+		__asm__ __volatile__("yield");
+	#endif
+	}
+
+	//the items can be copied with memcpy() in the batch operations, instead of constructing them one by one.
+	template <typename T>
+	struct is_bulk_copyable : boost::integral_constant<bool,
+		boost::has_trivial_copy<T>::value && boost::has_trivial_assign<T>::value && boost::has_trivial_destructor<T>::value> { };
+
+	//copies trivially copyable items to the slots, with CIRCULAR_QUEUE_STREAMING_STORES the stores bypass the cache.
+	template <typename T>
+	inline void copyItems(T *to, const T *from, std::size_t count){
+		std::size_t bytes = count * sizeof(T);
+	#if defined(CIRCULAR_QUEUE_STREAMING_STORES) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+		char *dst = static_cast<char*>(static_cast<void*>(to));
+		const char *src = static_cast<const char*>(static_cast<const void*>(from));
+		//the streaming stores need 16 byte aligned destination, the head and the tail are copied normally.
+		std::size_t head = (16u - ((std::size_t)dst & 15u)) & 15u;
+		if(head > bytes)
+			head = bytes;
+		std::memcpy(dst, src, head);
+		dst += head;
+		src += head;
+		bytes -= head;
+		for(; bytes >= 16u; bytes -= 16u, dst += 16u, src += 16u)
+			_mm_stream_si128((__m128i*)dst, _mm_loadu_si128((const __m128i*)src));
+		std::memcpy(dst, src, bytes);
+		//the streaming stores are weakly ordered, they need to be visible before the slots are published.
+		_mm_sfence();
+	#else
+		std::memcpy(to, from, bytes);
+	#endif
+	}
+
+#ifdef CIRCULAR_QUEUE_STD_ATOMIC
+	/* C++11 backend.
+	 * Publishing is done with release, consuming with acquire,
+	 * so it is safe on weakly ordered CPUs (ARM, POWER) without full barriers.
+	 */
+	template <typename V>
+	class atomic {
+	public:
+		atomic() : mValue(V()) { }
+
+		V loadAcquire() const { return mValue.load(std::memory_order_acquire); }
+		V loadRelaxed() const { return mValue.load(std::memory_order_relaxed); }
+		void storeRelease(V value){ mValue.store(value, std::memory_order_release); }
+		void storeRelaxed(V value){ mValue.store(value, std::memory_order_relaxed); }
+		//returns the value before the add. Only atomicity is guaranteed, it is used to get positions and tickets.
+		V fetchAdd(V value){ return mValue.fetch_add(value, std::memory_order_relaxed); }
+		//returns true, when the value was expected and it is replaced with desired.
+		//on failure, expected is updated to the current value.
+		bool compareExchange(V &expected, V desired){
+			return mValue.compare_exchange_strong(expected, desired, std::memory_order_acq_rel, std::memory_order_acquire);
+		}
+		//used by futex and WaitOnAddress.
+		void* address(){ return &mValue; }
+	private:
+		atomic(const atomic&);
+		atomic& operator=(const atomic&);
+
+		std::atomic<V> mValue;
+	};
+#else
+	#if BOOST_VERSION >= 104800
+		namespace ipc = boost::interprocess::ipcdetail;
+	#else
+		namespace ipc = boost::interprocess::detail;
+	#endif
+
+	/* Legacy backend: volatile and boost::interprocess atomics.
+	 * All compilers (what I've tested) will set mData before mHasData on x86,
+	 * but there is no guarantee for this on weakly ordered CPUs.
+	 * fetchAdd() and compareExchange() works only with boost::uint32_t.
+	 */
+	template <typename V>
+	class atomic {
+	public:
+		atomic() : mValue(V()) { }
+
+		V loadAcquire() const { return mValue; }
+		V loadRelaxed() const { return mValue; }
+		void storeRelease(V value){ mValue = value; }
+		void storeRelaxed(V value){ mValue = value; }
+		V fetchAdd(V value){ return ipc::atomic_add32(&mValue, value); }
+		bool compareExchange(V &expected, V desired){
+			V old = ipc::atomic_cas32(&mValue, desired, expected);
+			if(old == expected)
+				return true;
+			expected = old;
+			return false;
+		}
+		void* address(){ return (void*)&mValue; }
+	private:
+		atomic(const atomic&);
+		atomic& operator=(const atomic&);
+
+		volatile V mValue;
+	};
+#endif
+
+	//full memory barrier.
+	inline void fenceSeqCst(){
+	#ifdef CIRCULAR_QUEUE_STD_ATOMIC
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+	#elif defined(_MSC_VER)
+		long barrier;
+		_InterlockedExchange(&barrier, 0);
+	#else
+		__sync_synchronize();
+	#endif
+	}
+
+	//used with wait strategies, which don't sleep.
+	struct no_parking {
+		void notify(){ }
+	};
+
+	/* Used with park_wait, sleeping threads are woken up by notify().
+	 * When nobody sleeps, notify() is only a fence and a load, so there are no syscalls on the fast path.
+	 * 
+	 * The waiting thread:
+	 * 	1. registers itself with prepareWait() and gets the current epoch
+	 * 	2. checks the condition again
+	 * 	3. sleeps in commitWait() while the epoch is the same
+	 * 	4. unregisters with cancelWait()
+	 * notify() increases the epoch and wakes up everyone, when there are registered threads.
+	 */
+	class parking_lot {
+	public:
+		parking_lot() { }
+
+		boost::uint32_t prepareWait(){
+			mWaiters.fetchAdd(1);
+			//pairs with the fence in notify(): either we see the new data, or notify() sees us.
+			fenceSeqCst();
+			return mEpoch.loadAcquire();
+		}
+		boost::uint32_t currentKey() const {
+			return mEpoch.loadAcquire();
+		}
+		void commitWait(boost::uint32_t key, boost::uint32_t timeoutMicrosec){
+		#if defined(CIRCULAR_QUEUE_FUTEX)
+			struct timespec timeout;
+			timeout.tv_sec = timeoutMicrosec / 1000000u;
+			timeout.tv_nsec = (timeoutMicrosec % 1000000u) * 1000u;
+			syscall(SYS_futex, mEpoch.address(), FUTEX_WAIT_PRIVATE, key, &timeout, NULL, 0);
+		#elif defined(CIRCULAR_QUEUE_WAIT_ON_ADDRESS)
+			WaitOnAddress(mEpoch.address(), &key, sizeof(key), (timeoutMicrosec + 999u) / 1000u);
+		#else
+			boost::unique_lock<boost::mutex> lock(mMutex);
+			if(mEpoch.loadAcquire() == key)
+				mCondition.wait_for(lock, boost::chrono::microseconds(timeoutMicrosec));
+		#endif
+		}
+		void cancelWait(){
+			mWaiters.fetchAdd((boost::uint32_t)-1);
+		}
+		//notify() will notify lot too, NULL unlinks it.
+		void link(parking_lot *lot){
+			mLinked.storeRelease(lot);
+		}
+		parking_lot* linked() const {
+			return mLinked.loadAcquire();
+		}
+		void notify(){
+			fenceSeqCst();
+			//the threads waiting on more queues are woken up too.
+			parking_lot *linked = mLinked.loadAcquire();
+			if(linked)
+				linked->notify();
+			if(mWaiters.loadRelaxed() != 0){
+				mEpoch.fetchAdd(1);
+			#if defined(CIRCULAR_QUEUE_FUTEX)
+				syscall(SYS_futex, mEpoch.address(), FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+			#elif defined(CIRCULAR_QUEUE_WAIT_ON_ADDRESS)
+				WakeByAddressAll(mEpoch.address());
+			#else
+				//the waiting thread either sees the new epoch or it is already waiting.
+				{ boost::lock_guard<boost::mutex> lock(mMutex); }
+				mCondition.notify_all();
 			#endif
+			}
 		}
+	private:
+		parking_lot(const parking_lot&);
+		parking_lot& operator=(const parking_lot&);
+
+		atomic<boost::uint32_t> mEpoch; // increased on every notify() with waiters
+		atomic<boost::uint32_t> mWaiters; // number of registered threads
+		atomic<parking_lot*> mLinked; // notified together with this, set by circular_queue_set
+	#if !defined(CIRCULAR_QUEUE_FUTEX) && !defined(CIRCULAR_QUEUE_WAIT_ON_ADDRESS)
+		boost::mutex mMutex;
+		boost::condition_variable mCondition;
+	#endif
+	};
+
+	//used by pushFor() and popFor().
+#ifdef BOOST_CHRONO_HAS_CLOCK_STEADY
+	typedef boost::chrono::steady_clock timeout_clock;
+#else
+	typedef boost::chrono::system_clock timeout_clock;
+#endif
+
+	//raw memory for an item, it is constructed at push and destroyed at pop.
+	template <typename T>
+	class slot_storage {
+	public:
+		T* get(){ return static_cast<T*>(static_cast<void*>(&mStorage)); }
+	private:
+		typename boost::aligned_storage<sizeof(T), boost::alignment_of<T>::value>::type mStorage;
+	};
+
+	//wraps value, padded_layout puts it on its own cache line.
+	template <typename V, typename Layout>
+	struct layout_cell {
+		V value;
+	};
+	template <typename V>
+	struct BOOST_ALIGNMENT(CIRCULAR_QUEUE_CACHE_LINE_SIZE) layout_cell<V, padded_layout> {
+		V value;
+	};
+
+	/* Objects, each allocated with its own memory_placement, e.g. the shards of a queue.
+	 * It owns the created objects, like dynamic_storage owns its slots, so when a later allocation
+	 * or constructor throws, the destructor frees the ones created before.
+	 */
+	template <typename V>
+	class placed_array {
+	public:
+		placed_array() : mObjects(NULL), mPlacements(NULL), mCount(0) { }
+		~placed_array(){
+			for(boost::uint32_t i = 0; i < mCount; i++){
+				mObjects[i]->~V();
+				mPlacements[i].deallocate(mObjects[i], sizeof(V));
+			}
+			delete[] mObjects;
+			delete[] mPlacements;
+		}
+
+		//allocates the arrays for capacity objects, call it once before create().
+		void reserve(boost::uint32_t capacity){
+			BOOST_ASSERT(!mObjects);
+			mObjects = new V*[capacity];
+			mPlacements = new memory_placement[capacity];
+		}
+		//default constructs the next object in the memory of placement.
+		void create(const memory_placement &placement){
+			void *memory = placement.allocate(sizeof(V), boost::alignment_of<V>::value);
+			try {
+				mObjects[mCount] = new (memory) V();
+			} catch(...) {
+				placement.deallocate(memory, sizeof(V));
+				throw;
+			}
+			mPlacements[mCount] = placement;
+			mCount++;
+		}
+
+		V& operator[](boost::uint32_t i){ return *mObjects[i]; }
+		const memory_placement& placement(boost::uint32_t i) const { return mPlacements[i]; }
+	private:
+		placed_array(const placed_array&);
+		placed_array& operator=(const placed_array&);
+
+		V **mObjects;
+		memory_placement *mPlacements; // where the objects are allocated
+		boost::uint32_t mCount; // created objects
+	};
 
-		// 0x100000000 needs to be dividable by size or it will fail on overflow.
-		BOOST_STATIC_ASSERT( (0xFFFFFFFFu % size) == (size - 1) );
+#ifdef CIRCULAR_QUEUE_STD_ATOMIC
+	//the waits and exits are counted, they are the first events.
+	static const unsigned statsCounterCount = circular_queue_event::noMorePushExit + 1;
+
+	//index of the calling thread, it selects the counter shard.
+	inline boost::uint32_t threadIndex(){
+	#ifndef BOOST_NO_CXX11_THREAD_LOCAL
+		static atomic<boost::uint32_t> next;
+		static thread_local boost::uint32_t index = next.fetchAdd(1);
+		return index;
+	#else
+		return (boost::uint32_t)boost::hash<boost::thread::id>()(boost::this_thread::get_id());
+	#endif
+	}
+#endif
+
+	//tickets of a slot, they are empty bases, when the side is single-threaded.
+	template <bool enabled>
+	struct push_tickets {
+		atomic<boost::uint32_t> pushQueue; //get push ticket here
+		atomic<boost::uint32_t> pushTicket; //current active push ticket
+	};
+	template <>
+	struct push_tickets<false> { };
+	template <bool enabled>
+	struct pop_tickets {
+		atomic<boost::uint32_t> popQueue; //get pop ticket here
+		atomic<boost::uint32_t> popTicket; //current active pop ticket
+	};
+	template <>
+	struct pop_tickets<false> { };
+
+	//everything, what a push or pop touches, is in the same struct.
+	template <typename T, typename Concurrency>
+	struct ticket_slot : push_tickets<Concurrency::multiProducer>, pop_tickets<Concurrency::multiConsumer> {
+		slot_storage<T> data;
+		atomic<bool> hasData;
+	};
+
+	//ticket arrays of packed_layout, empty when the side is single-threaded.
+	template <bool enabled, boost::uint32_t size>
+	struct ticket_arrays {
+		atomic<boost::uint32_t> queue[size]; //get ticket here
+		atomic<boost::uint32_t> ticket[size]; //current active ticket
+	};
+	template <boost::uint32_t size>
+	struct ticket_arrays<false, size> { };
+
+	/* The ticket accessors are only instantiated, when the side is multi-threaded.
+	 */
+	template <typename T, boost::uint32_t size, typename Layout, typename Concurrency, typename Position>
+	class storage;
+
+	template <typename T, boost::uint32_t size, typename Concurrency, typename Position>
+	class storage<T, size, packed_layout, Concurrency, Position> {
+	protected:
+		//the items are next to each other, batches are copied with memcpy(), when T is trivially copyable.
+		static const bool contiguous = true;
+
+		storage() { }
+
+		typedef typename Position::type position_t;
+
+		static boost::uint32_t capacity(){ return size; }
+		static boost::uint32_t index(position_t pos){ return (boost::uint32_t)(pos % size); }
+		T* data(boost::uint32_t pos){ return mData[pos].get(); }
+		atomic<bool>& hasData(boost::uint32_t pos){ return mHasData[pos]; }
+		atomic<position_t>& writePos(){ return mWritePos; }
+		atomic<position_t>& readPos(){ return mReadPos; }
+		atomic<boost::uint32_t>& pushQueue(boost::uint32_t pos){ return mPushTickets.queue[pos]; }
+		atomic<boost::uint32_t>& pushTicket(boost::uint32_t pos){ return mPushTickets.ticket[pos]; }
+		atomic<boost::uint32_t>& popQueue(boost::uint32_t pos){ return mPopTickets.queue[pos]; }
+		atomic<boost::uint32_t>& popTicket(boost::uint32_t pos){ return mPopTickets.ticket[pos]; }
+	private:
+		/* Contains the queue items, they are constructed only while mHasData is true.
+		 * mHasData is set with release after mData is written, so it is safe without volatile.
+		 */
+		slot_storage<T> mData[size]; // queue items
+		atomic<bool> mHasData[size]; // signal between push and pop threads
+		atomic<position_t> mWritePos; // push position
+		atomic<position_t> mReadPos; //pop position
+
+		//ticket system works like a lock, but faster.
+		//when a thread want to push:
+		//	1. thread gets a ticket
+		//	2. waits for threads ticket in mPushTickets.ticket
+		//	3. waits for worker to process prev ticket.
+		//	3. pushes data
+		//	4. increases mPushTickets.ticket
+		ticket_arrays<Concurrency::multiProducer, size> mPushTickets;
+		ticket_arrays<Concurrency::multiConsumer, size> mPopTickets;
+	};
+
+	template <typename T, boost::uint32_t size, typename Concurrency, typename Position>
+	class storage<T, size, padded_layout, Concurrency, Position> {
+	protected:
+		static const bool contiguous = false;
+
+		storage() { }
+
+		typedef typename Position::type position_t;
+
+		static boost::uint32_t capacity(){ return size; }
+		static boost::uint32_t index(position_t pos){ return (boost::uint32_t)(pos % size); }
+		T* data(boost::uint32_t pos){ return mSlots[pos].value.data.get(); }
+		atomic<bool>& hasData(boost::uint32_t pos){ return mSlots[pos].value.hasData; }
+		atomic<position_t>& writePos(){ return mWritePos.value; }
+		atomic<position_t>& readPos(){ return mReadPos.value; }
+		atomic<boost::uint32_t>& pushQueue(boost::uint32_t pos){ return mSlots[pos].value.pushQueue; }
+		atomic<boost::uint32_t>& pushTicket(boost::uint32_t pos){ return mSlots[pos].value.pushTicket; }
+		atomic<boost::uint32_t>& popQueue(boost::uint32_t pos){ return mSlots[pos].value.popQueue; }
+		atomic<boost::uint32_t>& popTicket(boost::uint32_t pos){ return mSlots[pos].value.popTicket; }
+	private:
+		//everything, what a push or pop touches, is in the same cache line.
+		layout_cell<ticket_slot<T, Concurrency>, padded_layout> mSlots[size];
+		//pushing threads won't invalidate the cache line of mReadPos and vice versa.
+		layout_cell<atomic<position_t>, padded_layout> mWritePos; // push position
+		layout_cell<atomic<position_t>, padded_layout> mReadPos; // pop position
+	};
+}
+
+/*! \brief Stats policy: no counters.
+ * 
+ * This is the default, the hooks compile to nothing and getStats() returns zeros.
+ */
+struct no_stats {
+	static const bool enabled = false;
+	void add(circular_queue_event::type){ }
+	void recordLength(boost::int64_t){ }
+	circular_queue_stats snapshot() const {
+		circular_queue_stats stats = { };
+		return stats;
+	}
+	void clear(){ }
+};
+
+#ifdef CIRCULAR_QUEUE_STD_ATOMIC
+/*! \brief Stats policy: wait counters in per-thread shards, read them with getStats().
+ * 
+ * Every thread counts in its own shard, so the counters won't bounce between the caches of the threads.
+ * Only the threads sharing a shard (more threads than shards) increment the same cache line.
+ * It needs std::atomic, the counters are 64 bit.
+ * 
+ * @tparam shards Number of counter shards, threads are spread on them.
+ */
+template <unsigned shards = 16u>
+class sharded_stats {
+public:
+	static const bool enabled = true;
+	void add(circular_queue_event::type counter){
+		shard().counters[counter].fetchAdd(1);
+	}
+	//length is negative, when popping threads are waiting.
+	void recordLength(boost::int64_t length){
+		if(length <= 0)
+			return;
+		circular_queue_detail::atomic<boost::uint64_t> &highWater = shard().highWater;
+		boost::uint64_t current = highWater.loadRelaxed();
+		while((boost::uint64_t)length > current && !highWater.compareExchange(current, (boost::uint64_t)length)) { }
+	}
+	circular_queue_stats snapshot() const {
+		boost::uint64_t counters[circular_queue_detail::statsCounterCount] = { };
+		boost::uint64_t highWater = 0;
+		for(unsigned i = 0; i < shards; i++){
+			const shard_counters &counts = mShards[i].value;
+			for(unsigned c = 0; c < circular_queue_detail::statsCounterCount; c++)
+				counters[c] += counts.counters[c].loadRelaxed();
+			if(counts.highWater.loadRelaxed() > highWater)
+				highWater = counts.highWater.loadRelaxed();
+		}
+		circular_queue_stats stats;
+		stats.pushTicketWaits = counters[circular_queue_event::pushTicketWait];
+		stats.popTicketWaits = counters[circular_queue_event::popTicketWait];
+		stats.fullWaits = counters[circular_queue_event::fullWait];
+		stats.emptyWaits = counters[circular_queue_event::emptyWait];
+		stats.noMorePushExits = counters[circular_queue_event::noMorePushExit];
+		stats.highWater = highWater;
+		return stats;
+	}
+	void clear(){
+		for(unsigned i = 0; i < shards; i++){
+			for(unsigned c = 0; c < circular_queue_detail::statsCounterCount; c++)
+				mShards[i].value.counters[c].storeRelaxed(0);
+			mShards[i].value.highWater.storeRelaxed(0);
+		}
+	}
+private:
+	struct shard_counters {
+		circular_queue_detail::atomic<boost::uint64_t> counters[circular_queue_detail::statsCounterCount];
+		circular_queue_detail::atomic<boost::uint64_t> highWater;
+	};
+	shard_counters& shard(){
+		return mShards[circular_queue_detail::threadIndex() % shards].value;
+	}
+
+	circular_queue_detail::layout_cell<shard_counters, padded_layout> mShards[shards];
+};
+#endif
+
+#ifdef CIRCULAR_QUEUE_VERBOSE
+/*! \brief Tracer: writes the push, pop and close events to cout, selected by CIRCULAR_QUEUE_VERBOSE.
+ * 
+ * The writes are serialized with a mutex, so it changes the timing of the threads. Use it only for debugging.
+ */
+struct cout_trace {
+	static void event(const void *queue, circular_queue_event::type event, boost::uint64_t pos, boost::uint32_t count){
+		//the waits would flood the output.
+		if(event < circular_queue_event::push)
+			return;
+		boost::lock_guard<boost::mutex> lock(mutex());
+		std::cout << queue << " " << circular_queue_event::name(event) << " " << pos;
+		if(count > 1)
+			std::cout << " +" << count;
+		std::cout << std::endl;
+	}
+private:
+	//function local static, so there is one mutex in the program, and the header can be in more translation units.
+	static boost::mutex& mutex(){
+		static boost::mutex coutMutex;
+		return coutMutex;
+	}
+};
+#endif
+
+#ifdef CIRCULAR_QUEUE_USDT
+/*! \brief Tracer: emits USDT probes, selected by CIRCULAR_QUEUE_USDT.
+ * 
+ * A probe is a nop, until a tracer attaches to it, e.g. perf probe sdt_circular_queue:push, or bpftrace usdt:./app:circular_queue:fullWait.
+ * The arguments are the queue address, the position and the count.
+ */
+struct usdt_trace {
+	static void event(const void *queue, circular_queue_event::type event, boost::uint64_t pos, boost::uint32_t count){
+		switch(event){
+		case circular_queue_event::pushTicketWait: DTRACE_PROBE3(circular_queue, pushTicketWait, queue, pos, count); break;
+		case circular_queue_event::popTicketWait: DTRACE_PROBE3(circular_queue, popTicketWait, queue, pos, count); break;
+		case circular_queue_event::fullWait: DTRACE_PROBE3(circular_queue, fullWait, queue, pos, count); break;
+		case circular_queue_event::emptyWait: DTRACE_PROBE3(circular_queue, emptyWait, queue, pos, count); break;
+		case circular_queue_event::noMorePushExit: DTRACE_PROBE3(circular_queue, noMorePushExit, queue, pos, count); break;
+		case circular_queue_event::push: DTRACE_PROBE3(circular_queue, push, queue, pos, count); break;
+		case circular_queue_event::pop: DTRACE_PROBE3(circular_queue, pop, queue, pos, count); break;
+		case circular_queue_event::close: DTRACE_PROBE3(circular_queue, close, queue, pos, count); break;
+		default: break;
+		}
+	}
+};
+#endif
+
+#ifdef CIRCULAR_QUEUE_TRACE_RING
+/*! \brief Tracer: records the events in per-thread rings, selected by CIRCULAR_QUEUE_TRACE_RING.
+ * 
+ * Every thread writes only its own ring, without atomic read-modify-write, so tracing doesn't serialize the threads.
+ * The rings are allocated at the first event of a thread and never freed, so the events of finished threads can be read too.
+ * Each ring keeps the last CIRCULAR_QUEUE_TRACE_RING_SIZE events.
+ */
+class ring_trace {
+public:
+	//! One event.
+	struct record {
+		boost::uint64_t time; //!< nanoseconds of the steady clock
+		const void *queue; //!< the queue
+		boost::uint64_t pos; //!< position
+		boost::uint32_t count; //!< number of positions
+		circular_queue_event::type event; //!< the event
+	};
+
+	static void event(const void *queue, circular_queue_event::type event, boost::uint64_t pos, boost::uint32_t count){
+		ring &mine = local();
+		boost::uint64_t index = mine.written.loadRelaxed();
+		record &rec = mine.records[index % CIRCULAR_QUEUE_TRACE_RING_SIZE];
+		rec.time = boost::chrono::duration_cast<boost::chrono::nanoseconds>(
+			boost::chrono::steady_clock::now().time_since_epoch()).count();
+		rec.queue = queue;
+		rec.pos = pos;
+		rec.count = count;
+		rec.event = event;
+		mine.written.storeRelease(index + 1);
+	}
+
+	/*! \brief Calls f(thread, record) for the recorded events, oldest first in each thread.
+	 * 
+	 * Call it when the traced threads are idle or finished, else the oldest records may be overwritten while they are read.
+	 * 
+	 * @param f Function object, called with the index of the thread (boost::uint32_t) and the record.
+	 */
+	template <class F>
+	static void forEach(F f){
+		for(ring *r = head().loadAcquire(); r; r = r->next){
+			boost::uint64_t written = r->written.loadAcquire();
+			boost::uint64_t first = written > CIRCULAR_QUEUE_TRACE_RING_SIZE ? written - CIRCULAR_QUEUE_TRACE_RING_SIZE : 0;
+			for(boost::uint64_t i = first; i < written; i++)
+				f(r->thread, r->records[i % CIRCULAR_QUEUE_TRACE_RING_SIZE]);
+		}
+	}
+
+	/*! \brief Writes the recorded events in Chrome trace event format (JSON).
+	 * 
+	 * Open it in Perfetto UI or chrome://tracing, every thread is a track, every event is an instant event.
+	 * Same restrictions as forEach().
+	 */
+	static void writeChromeTrace(std::ostream &out){
+		out << "{\"traceEvents\":[";
+		chrome_writer writer(out);
+		forEach(writer);
+		out << "]}\n";
+	}
+
+	/*! \brief Drops the recorded events.
+	 * 
+	 * Call it when the traced threads are idle.
+	 */
+	static void clear(){
+		for(ring *r = head().loadAcquire(); r; r = r->next)
+			r->written.storeRelease(0);
+	}
+private:
+	struct ring {
+		circular_queue_detail::atomic<boost::uint64_t> written; // number of events written, only the owner thread writes it
+		ring *next;
+		boost::uint32_t thread;
+		record records[CIRCULAR_QUEUE_TRACE_RING_SIZE];
+	};
+	struct chrome_writer {
+		explicit chrome_writer(std::ostream &o) : out(o), first(true) { }
+		void operator()(boost::uint32_t thread, const record &rec){
+			if(!first)
+				out << ",";
+			first = false;
+			out << "{\"name\":\"" << circular_queue_event::name(rec.event) << "\",\"ph\":\"i\",\"s\":\"t\",\"pid\":0,\"tid\":" << thread
+				<< ",\"ts\":" << rec.time / 1000 << "." << (rec.time % 1000) / 100 << (rec.time % 100) / 10 << rec.time % 10
+				<< ",\"args\":{\"queue\":\"" << rec.queue << "\",\"pos\":" << rec.pos << ",\"count\":" << rec.count << "}}";
+		}
+		std::ostream &out;
+		bool first;
+	};
+
+	//function local statics, so they are the same in all translation units.
+	static circular_queue_detail::atomic<ring*>& head(){
+		static circular_queue_detail::atomic<ring*> rings;
+		return rings;
+	}
+	static ring& local(){
+		static thread_local ring *mine = NULL;
+		if(!mine)
+			mine = add();
+		return *mine;
+	}
+	static ring* add(){
+		static circular_queue_detail::atomic<boost::uint32_t> threads;
+		ring *r = new ring();
+		r->thread = threads.fetchAdd(1);
+		r->next = head().loadRelaxed();
+		while(!head().compareExchange(r->next, r)) { }
+		return r;
+	}
+};
+#endif
+
+#define CIRCULAR_QUEUE_STATS_ADD(event) mStats.add(event)
+//the length is not even loaded with no_stats.
+#define CIRCULAR_QUEUE_COUNT_LENGTH(length) { if(Stats::enabled) mStats.recordLength(length); }
+#ifdef CIRCULAR_QUEUE_TRACE
+	#define CIRCULAR_QUEUE_TRACE_EVENT(name, pos, count) CIRCULAR_QUEUE_TRACE::event(this, circular_queue_event::name, pos, count)
+#else
+	#define CIRCULAR_QUEUE_TRACE_EVENT(name, pos, count)
+#endif
+//counts and traces a wait or exit in the queue, it is compiled out with no_stats and without CIRCULAR_QUEUE_TRACE.
+#define CIRCULAR_QUEUE_COUNT(name) { CIRCULAR_QUEUE_STATS_ADD(circular_queue_event::name); CIRCULAR_QUEUE_TRACE_EVENT(name, 0, 0); }
+
+/*! \brief Wait strategy: calls CIRCULAR_QUEUE_WAIT(), by default it is yield.
+ * 
+ * Wait strategies are created at the start of every waiting operation,
+ * and wait() is called on every unsuccessful check. So they can count, how long the thread is waiting.
+ * The queue has a parking member, which is notified after every push and pop,
+ * it is passed to the constructor of the wait strategy.
+ */
+struct default_wait {
+	typedef circular_queue_detail::no_parking parking;
+	explicit default_wait(parking&) { }
+	void wait(){
+		CIRCULAR_QUEUE_WAIT();
+	}
+};
+
+/*! \brief Wait strategy: busy spin with CPU pause instruction.
+ * 
+ * Lowest latency, but burns a whole core while waiting.
+ * Use it only, when there are less threads than cores.
+ */
+struct spin_wait {
+	typedef circular_queue_detail::no_parking parking;
+	explicit spin_wait(parking&) { }
+	void wait(){
+		circular_queue_detail::cpuPause();
+	}
+};
+
+/*! \brief Wait strategy: spins for a while, then yields.
+ * 
+ * @tparam spins Number of spins before yield.
+ */
+template <boost::uint32_t spins = 64u>
+class spin_yield_wait {
+public:
+	typedef circular_queue_detail::no_parking parking;
+	explicit spin_yield_wait(parking&) : mCount(0) { }
+	void wait(){
+		if(mCount < spins){
+			mCount++;
+			circular_queue_detail::cpuPause();
+		} else {
+			boost::this_thread::yield();
+		}
+	}
+private:
+	boost::uint32_t mCount;
+};
+
+/*! \brief Wait strategy: exponential backoff.
+ * 
+ * Number of spins are doubled on every wait, until maxSpins is reached, then it yields.
+ * 
+ * @tparam minSpins Number of spins for the first wait.
+ * @tparam maxSpins Maximum number of spins.
+ */
+template <boost::uint32_t minSpins = 1u, boost::uint32_t maxSpins = 1024u>
+class backoff_wait {
+public:
+	typedef circular_queue_detail::no_parking parking;
+	explicit backoff_wait(parking&) : mSpins(minSpins) { }
+	void wait(){
+		if(mSpins <= maxSpins){
+			for(boost::uint32_t i = 0; i < mSpins; i++)
+				circular_queue_detail::cpuPause();
+			mSpins *= 2;
+		} else {
+			boost::this_thread::yield();
+		}
+	}
+private:
+	boost::uint32_t mSpins;
+};
+
+/*! \brief Wait strategy: spins, yields, then goes to sleep.
+ * 
+ * Use this for long living queues, idle threads won't burn CPU.
+ * 
+ * @tparam spins Number of spins.
+ * @tparam yields Number of yields after spinning.
+ * @tparam sleepMicrosec Time to sleep on every wait after yielding.
+ */
+template <boost::uint32_t spins = 64u, boost::uint32_t yields = 64u, boost::uint32_t sleepMicrosec = 1000u>
+class spin_sleep_wait {
+public:
+	typedef circular_queue_detail::no_parking parking;
+	explicit spin_sleep_wait(parking&) : mCount(0) { }
+	void wait(){
+		if(mCount < spins){
+			mCount++;
+			circular_queue_detail::cpuPause();
+		} else if(mCount < spins + yields){
+			mCount++;
+			boost::this_thread::yield();
+		} else {
+			boost::this_thread::sleep_for(boost::chrono::microseconds(sleepMicrosec));
+		}
+	}
+private:
+	boost::uint32_t mCount;
+};
+
+/*! \brief Wait strategy: spins for a while, then sleeps until a push or pop happens.
+ * 
+ * Sleeping is done on futex (Linux), WaitOnAddress (Windows 8+) or condition variable.
+ * Idle threads won't use CPU, and there are no syscalls in push/pop, while nobody sleeps.
+ * The sleep is limited with timeoutMicrosec, so pushFor() and popFor() may wait that much more, than requested.
+ * 
+ * @tparam spins Number of spins before going to sleep.
+ * @tparam timeoutMicrosec Maximum time of one sleep.
+ */
+template <boost::uint32_t spins = 256u, boost::uint32_t timeoutMicrosec = 10000u>
+class park_wait {
+public:
+	typedef circular_queue_detail::parking_lot parking;
+	explicit park_wait(parking &lot) :
+		mLot(lot),
+		mCount(0),
+		mKey(0),
+		mRegistered(false)
+	{
+	}
+	~park_wait(){
+		if(mRegistered)
+			mLot.cancelWait();
+	}
+	void wait(){
+		if(mCount < spins){
+			mCount++;
+			circular_queue_detail::cpuPause();
+		} else if(!mRegistered){
+			//the queue will check the condition again, before we go to sleep.
+			mKey = mLot.prepareWait();
+			mRegistered = true;
+		} else {
+			mLot.commitWait(mKey, timeoutMicrosec);
+			mKey = mLot.currentKey();
+		}
+	}
+private:
+	park_wait(const park_wait&);
+	park_wait& operator=(const park_wait&);
+
+	parking &mLot;
+	boost::uint32_t mCount;
+	boost::uint32_t mKey;
+	bool mRegistered;
+};
+
+/*! \brief The circular queue.
+ * 
+ * Items are constructed in the slot at push, and destroyed in the slot at pop,
+ * so T doesn't need default constructor and the empty slots are not constructed objects.
+ * 
+ * @tparam T Type of the items.
+ * @tparam size Number of slots, needs to be power of two with position32.
+ * @tparam Layout Memory layout of the slots: packed_layout or padded_layout.
+ * @tparam Wait Wait strategy: default_wait, spin_wait, spin_yield_wait, backoff_wait, spin_sleep_wait or park_wait.
+ * @tparam Concurrency Number of pushing and popping threads: mpmc, mpsc, spmc or spsc.
+ * 	The tickets are only stored and used for the multi-threaded sides.
+ * @tparam Position Width of the push and pop positions: position32 or position64.
+ * @tparam Stats Wait counters: no_stats or sharded_stats.
+ */
+template <typename T, boost::uint32_t size = 32u, typename Layout = packed_layout, typename Wait = default_wait, typename Concurrency = mpmc,
+	typename Position = position32, typename Stats = no_stats>
+class circular_queue : private circular_queue_detail::storage<T, size, Layout, Concurrency, Position> {
+public:
+	typedef T value_type; //!< type of the items, used by batching_producer
+
+	circular_queue()
+	{
+		// with position32, 0x100000000 needs to be dividable by size or it will fail on overflow.
+		BOOST_STATIC_ASSERT( Position::template valid_size<size>::value );
 	}
 
 	virtual ~circular_queue(){
-		#ifdef CIRCULAR_QUEUE_SAFE_DELETE
-			bool hasData = false;
-			for(boost::uint32_t i = 0; i < size; i++){
-				hasData |= mHasData[i];
+		bool hasData = false;
+		for(boost::uint32_t i = 0; i < this->capacity(); i++){
+			if(this->hasData(i).loadRelaxed()){
+				hasData = true;
+				this->data(i)->~T();
 			}
+		}
+		#ifdef CIRCULAR_QUEUE_SAFE_DELETE
 			//asserts, when you delete a non-empty queue.
 			//you can disable this assert by defining CIRCULAR_QUEUE_SAFE_DELETE
-			BOOST_ASSERT(!hasData)
+			BOOST_ASSERT(!hasData);
 		#endif
+		(void)hasData;
 	}
 	
 	/*! \brief Push item to queue without push thread-safety.
@@ -137,93 +1272,327 @@ public:
 	 * @param item The item to push to the queue.
 	 */
 	void pushUnsafe(const T &item){
-		BOOST_ASSERT(!mNoMorePush);
-		boost::uint32_t mypos = mWritePos;
-		mWritePos++;
-		
-		#ifdef CIRCULAR_QUEUE_VERBOSE
-			COUT_WRITE("push " << mypos << std::endl);
-		#endif
-		mypos %= size;
-
-		//queue is full, wait for workers.
-		while(mHasData[mypos] != false){
-			CIRCULAR_QUEUE_WAIT();
-		}
-
-		mData[mypos] = item;
-		mHasData[mypos] = true;
+		boost::uint32_t mypos = claimPushSlot(boost::false_type());
+		new (this->data(mypos)) T(item);
+		publishPushSlot(mypos, boost::false_type());
 	}
-#ifndef CIRCULAR_QUEUE_DISABLE_SAFE_PUSH
+#ifndef BOOST_NO_CXX11_RVALUE_REFERENCES
+	/*! \brief Push item to queue without push thread-safety.
+	 * 
+	 * Same as pushUnsafe(const T&), but the item is moved into the queue.
+	 * 
+	 * @param item The item to push to the queue.
+	 */
+	void pushUnsafe(T &&item){
+		boost::uint32_t mypos = claimPushSlot(boost::false_type());
+		new (this->data(mypos)) T(std::move(item));
+		publishPushSlot(mypos, boost::false_type());
+	}
+#endif
 	/*! \brief Push item to queue.
 	 * 
-	 * Thread-safe push.
+	 * Thread-safe push, when Concurrency is mpmc or mpsc.
 	 * 
 	 * @param item The item to push to the queue.
 	 */
 	void push(const T &item){
-		BOOST_ASSERT(!mNoMorePush);
-		boost::uint32_t mypos = boost::interprocess::detail::atomic_inc32(&mWritePos);
-		
-		#ifdef CIRCULAR_QUEUE_VERBOSE
-			COUT_WRITE("push " << mypos << std::endl);
-		#endif
-		mypos %= size;
-		
-		boost::uint32_t ticket = boost::interprocess::detail::atomic_inc32(&mPushQueue[mypos]);
+		boost::uint32_t mypos = claimPushSlot(multi_producer());
+		new (this->data(mypos)) T(item);
+		publishPushSlot(mypos, multi_producer());
+	}
+#ifndef BOOST_NO_CXX11_RVALUE_REFERENCES
+	/*! \brief Push item to queue.
+	 * 
+	 * Thread-safe push, the item is moved into the queue.
+	 * 
+	 * @param item The item to push to the queue.
+	 */
+	void push(T &&item){
+		boost::uint32_t mypos = claimPushSlot(multi_producer());
+		new (this->data(mypos)) T(std::move(item));
+		publishPushSlot(mypos, multi_producer());
+	}
+#endif
+#if !defined(BOOST_NO_CXX11_RVALUE_REFERENCES) && !defined(BOOST_NO_CXX11_VARIADIC_TEMPLATES)
+	/*! \brief Construct item in the queue.
+	 * 
+	 * Thread-safe push, the item is constructed directly in the slot of the queue.
+	 * 
+	 * @param args Arguments for the constructor of T.
+	 */
+	template <class... Args>
+	void emplace(Args&&... args){
+		boost::uint32_t mypos = claimPushSlot(multi_producer());
+		new (this->data(mypos)) T(std::forward<Args>(args)...);
+		publishPushSlot(mypos, multi_producer());
+	}
+#endif
 
-		//another thread is pushing on the same queue item.
-		//happens, when a thread is doing a push() and the cpu is switched to other thread, which pushes 32 items, before the other thread can do the push.
-		//this is rare situation, you should increase size for speed-up, when this happens.
-		while(ticket != mPushTicket[mypos]){
-			CIRCULAR_QUEUE_WAIT();
-		}
+	/*! \brief Push item to queue, when it can be done without waiting.
+	 * 
+	 * Thread-safe push, it can be mixed with push().
+	 * The position is only taken, when the slot is free, so it won't wait for workers or other pushing threads.
+	 * 
+	 * @param item The item to push to the queue.
+	 * @return True, when the item is pushed. False, when queue is full.
+	 */
+	bool tryPush(const T &item){
+		boost::uint32_t mypos;
+		if(!tryClaimPushSlot(mypos, multi_producer()))
+			return false;
+		new (this->data(mypos)) T(item);
+		publishPushSlot(mypos, multi_producer());
+		return true;
+	}
+#ifndef BOOST_NO_CXX11_RVALUE_REFERENCES
+	/*! \brief Push item to queue, when it can be done without waiting.
+	 * 
+	 * Same as tryPush(const T&), but the item is moved into the queue.
+	 * The item is only moved, when it is pushed.
+	 * 
+	 * @param item The item to push to the queue.
+	 * @return True, when the item is pushed. False, when queue is full.
+	 */
+	bool tryPush(T &&item){
+		boost::uint32_t mypos;
+		if(!tryClaimPushSlot(mypos, multi_producer()))
+			return false;
+		new (this->data(mypos)) T(std::move(item));
+		publishPushSlot(mypos, multi_producer());
+		return true;
+	}
+#endif
+#if !defined(BOOST_NO_CXX11_RVALUE_REFERENCES) && !defined(BOOST_NO_CXX11_VARIADIC_TEMPLATES)
+	/*! \brief Construct item in the queue, when it can be done without waiting.
+	 * 
+	 * Same as emplace(), but returns false, when queue is full.
+	 * 
+	 * @param args Arguments for the constructor of T.
+	 * @return True, when the item is pushed. False, when queue is full.
+	 */
+	template <class... Args>
+	bool tryEmplace(Args&&... args){
+		boost::uint32_t mypos;
+		if(!tryClaimPushSlot(mypos, multi_producer()))
+			return false;
+		new (this->data(mypos)) T(std::forward<Args>(args)...);
+		publishPushSlot(mypos, multi_producer());
+		return true;
+	}
+#endif
 
-		//queue is full, wait for workers.
-		while(mHasData[mypos]){
-			CIRCULAR_QUEUE_WAIT();
+	/*! \brief Reserve a slot for writing the item in place.
+	 * 
+	 * Thread-safe push in two steps, it waits for a free slot like push().
+	 * The returned memory is not a constructed object, you need to construct T in it (placement new,
+	 * or write it directly, when T is trivially copyable, e.g. recv() into it), then call commitPush().
+	 * The popping threads will wait for this slot, so don't hold it for long.
+	 * 
+	 * @param slot Set to the reserved slot, pass it to commitPush().
+	 * @return Pointer to the storage of the slot.
+	 */
+	T* reservePush(boost::uint32_t &slot){
+		slot = claimPushSlot(multi_producer());
+		return this->data(slot);
+	}
+
+	/*! \brief Publish the item written to the slot got from reservePush().
+	 * 
+	 * @param slot The slot from reservePush().
+	 */
+	void commitPush(boost::uint32_t slot){
+		publishPushSlot(slot, multi_producer());
+	}
+
+	/*! \brief Push items to queue.
+	 * 
+	 * Thread-safe push, the positions for all items are taken with a single atomic operation,
+	 * so the items will be next to each other in the queue.
+	 * With packed_layout, trivially copyable T and a single pushing thread (spmc or spsc), the items are copied
+	 * with one memcpy() until the end of the slot array.
+	 * 
+	 * @param items The items to push to the queue.
+	 * @param count Number of items.
+	 */
+	void push(const T *items, std::size_t count){
+		pushItems(items, count, bulk_push());
+	}
+
+	/*! \brief Push items to queue.
+	 * 
+	 * Thread-safe push, the positions for all items are taken with a single atomic operation,
+	 * so the items will be next to each other in the queue.
+	 * 
+	 * @param first Iterator to the first item to push.
+	 * @param last Iterator after the last item to push.
+	 */
+	template <class ForwardIt>
+	void push(ForwardIt first, ForwardIt last){
+		BOOST_ASSERT(!mNoMorePush.loadRelaxed());
+		boost::uint32_t count = (boost::uint32_t)std::distance(first, last);
+		position_t pos = takeWritePos(count, multi_producer());
+		CIRCULAR_QUEUE_COUNT_LENGTH((position_diff_t)(pos + count - this->readPos().loadRelaxed()));
+
+		CIRCULAR_QUEUE_TRACE_EVENT(push, pos, count);
+
+		Wait waiter(mParking);
+		for(; first != last; ++first, ++pos){
+			boost::uint32_t mypos = waitPushSlot(pos, waiter, multi_producer());
+			new (this->data(mypos)) T(*first);
+			//the workers can start with the first items, while we wait for the rest.
+			publishPushSlot(mypos, multi_producer());
 		}
+	}
+
+	/*! \brief Push item to queue, wait until there is a free slot or the timeout expires.
+	 * 
+	 * Thread-safe push, it can be mixed with push().
+	 * Waiting is done with tryPush(), so there is no fair threading between the waiting threads.
+	 * 
+	 * @param item The item to push to the queue.
+	 * @param relTime Maximum time to wait.
+	 * @return True, when the item is pushed. False, when the timeout expired.
+	 */
+	template <class Rep, class Period>
+	bool pushFor(const T &item, const boost::chrono::duration<Rep, Period> &relTime){
+		return pushUntil(item, circular_queue_detail::timeout_clock::now() + relTime);
+	}
 
-		mData[mypos] = item;
-		mHasData[mypos] = true;
-		mPushTicket[mypos]++;
+	/*! \brief Push item to queue, wait until there is a free slot or the deadline.
+	 * 
+	 * Thread-safe push, it can be mixed with push().
+	 * Waiting is done with tryPush(), so there is no fair threading between the waiting threads.
+	 * 
+	 * @param item The item to push to the queue.
+	 * @param absTime Deadline.
+	 * @return True, when the item is pushed. False, when the deadline is reached.
+	 */
+	template <class Clock, class Duration>
+	bool pushUntil(const T &item, const boost::chrono::time_point<Clock, Duration> &absTime){
+		Wait waiter(mParking);
+		while(!tryPush(item)){
+			if(Clock::now() >= absTime)
+				return false;
+			CIRCULAR_QUEUE_COUNT(fullWait);
+			waiter.wait();
+		}
+		return true;
 	}
-#endif //CIRCULAR_QUEUE_DISABLE_SAFE_PUSH
-#ifndef CIRCULAR_QUEUE_DISABLE_SAFE_POP
 	/*! \brief Pop item from queue and return the popped item.
 	 * 
-	 * Thread-safe pop.
+	 * Thread-safe pop, when Concurrency is mpmc or spmc.
 	 * 
-	 * @param item Item, where the popped item will be copied.
+	 * @param item Item, where the popped item will be moved.
 	 * @return True, when success. False, when queue is empty and signalNoMorePush() was called.
 	 */
 	bool pop(T &item){
-		boost::uint32_t mypos = boost::interprocess::detail::atomic_inc32(&mReadPos);
-		#ifdef CIRCULAR_QUEUE_VERBOSE
-		COUT_WRITE("pop " << mypos << std::endl);
-		#endif
-		mypos %= size;
-		
-		boost::uint32_t ticket = boost::interprocess::detail::atomic_inc32(&mPopQueue[mypos]);
+		boost::uint32_t mypos;
+		if(!claimPopSlot(mypos, multi_consumer()))
+			return false;
+		item = boost::move(*this->data(mypos));
+		freePopSlot(mypos, multi_consumer());
+		return true;
+	}
 
-		//another thread is popping on the same queue item.
-		//this is rare situation, you should increase size for speed-up, when this happens.
-		while(ticket != mPopTicket[mypos]){
-			if(mNoMorePush)
-				return false;
-			CIRCULAR_QUEUE_WAIT();
+	/*! \brief Pop item from queue, when it can be done without waiting.
+	 * 
+	 * Thread-safe pop, it can be mixed with pop().
+	 * The position is only taken, when the slot has data, so it won't wait for data or other popping threads.
+	 * 
+	 * @param item Item, where the popped item will be moved.
+	 * @return True, when success. False, when queue is empty.
+	 */
+	bool tryPop(T &item){
+		boost::uint32_t mypos;
+		if(!tryClaimPopSlot(mypos, multi_consumer()))
+			return false;
+		item = boost::move(*this->data(mypos));
+		freePopSlot(mypos, multi_consumer());
+		return true;
+	}
+
+	/*! \brief Pop items from queue.
+	 * 
+	 * Thread-safe pop, it can be mixed with pop().
+	 * It waits for data, and pops the items availible (maximum count), the positions are taken with a single atomic operation.
+	 * 
+	 * @param out Output iterator, where the popped items will be moved.
+	 * @param count Maximum number of items to pop.
+	 * @return Number of popped items. Zero, when count is zero, or queue is empty and signalNoMorePush() was called.
+	 */
+	template <class OutputIt>
+	std::size_t pop(OutputIt out, std::size_t count){
+		//nothing would be ready, it would wait forever.
+		if(count == 0)
+			return 0;
+		position_t pos;
+		boost::uint32_t ready = claimPopRange(pos, count);
+		if(ready == 0)
+			return 0;
+		for(boost::uint32_t i = 0; i < ready; i++, pos++, ++out){
+			boost::uint32_t mypos = this->index(pos);
+			takePopTicket(mypos, multi_consumer());
+			*out = boost::move(*this->data(mypos));
+			clearPopSlot(mypos, multi_consumer());
 		}
+		mParking.notify();
+		return ready;
+	}
 
-		//queue is empty, wait for data.
-		while(!mHasData[mypos]){
-			if(mNoMorePush)
+	/*! \brief Pop items from queue to an array.
+	 * 
+	 * Same as pop(OutputIt, std::size_t), but with packed_layout and trivially copyable T,
+	 * the items are copied with one memcpy() until the end of the slot array.
+	 * 
+	 * @param out Array, where the popped items will be moved.
+	 * @param count Maximum number of items to pop.
+	 * @return Number of popped items. Zero, when count is zero, or queue is empty and signalNoMorePush() was called.
+	 */
+	std::size_t pop(T *out, std::size_t count){
+		if(count == 0)
+			return 0;
+		return popItems(out, count, bulk_copy());
+	}
+
+	/*! \brief Pop item from queue, wait until there is data or the timeout expires.
+	 * 
+	 * Thread-safe pop, it can be mixed with pop().
+	 * Waiting is done with tryPop(), so there is no fair threading between the waiting threads.
+	 * 
+	 * @param item Item, where the popped item will be moved.
+	 * @param relTime Maximum time to wait.
+	 * @return True, when success. False, when the timeout expired or queue is empty and signalNoMorePush() was called.
+	 */
+	template <class Rep, class Period>
+	bool popFor(T &item, const boost::chrono::duration<Rep, Period> &relTime){
+		return popUntil(item, circular_queue_detail::timeout_clock::now() + relTime);
+	}
+
+	/*! \brief Pop item from queue, wait until there is data or the deadline.
+	 * 
+	 * Thread-safe pop, it can be mixed with pop().
+	 * Waiting is done with tryPop(), so there is no fair threading between the waiting threads.
+	 * 
+	 * @param item Item, where the popped item will be moved.
+	 * @param absTime Deadline.
+	 * @return True, when success. False, when the deadline is reached or queue is empty and signalNoMorePush() was called.
+	 */
+	template <class Clock, class Duration>
+	bool popUntil(T &item, const boost::chrono::time_point<Clock, Duration> &absTime){
+		Wait waiter(mParking);
+		while(!tryPop(item)){
+			//items pushed before signalNoMorePush() are still popped, even when the push is not finished yet.
+			if(isDrainedAt(this->readPos().loadRelaxed())){
+				if(tryPop(item))
+					return true;
+				CIRCULAR_QUEUE_COUNT(noMorePushExit);
 				return false;
-			CIRCULAR_QUEUE_WAIT();
+			}
+			if(Clock::now() >= absTime)
+				return false;
+			CIRCULAR_QUEUE_COUNT(emptyWait);
+			waiter.wait();
 		}
-		
-		item = mData[mypos];
-		mHasData[mypos] = false;
-		mPopTicket[mypos]++;
 		return true;
 	}
 
@@ -231,42 +1600,52 @@ public:
 	 * 
 	 * Thread-safe pop.
 	 * Will throw exNoMorePush exception, when queue is empty and signalNoMorePush() was called.
+	 * The returned item is move constructed from the slot.
 	 * 
 	 * @return The item popped.
 	 */
 	T pop(){
-		T data;
-		if(pop(data))
-			return data;
-		else
+		boost::uint32_t mypos;
+		if(!claimPopSlot(mypos, multi_consumer()))
 			throw exNoMorePush();
+		T data(boost::move(*this->data(mypos)));
+		freePopSlot(mypos, multi_consumer());
+		return data;
+	}
+	/*! \brief Get the next item in place, without moving it out of the queue.
+	 * 
+	 * Thread-safe pop in two steps, it waits for data like pop().
+	 * The item stays in the slot, until releasePop() is called, the pushing threads will wait for this slot.
+	 * 
+	 * @param slot Set to the popped slot, pass it to releasePop().
+	 * @return Pointer to the item. NULL, when queue is empty and signalNoMorePush() was called.
+	 */
+	const T* peekPop(boost::uint32_t &slot){
+		if(!claimPopSlot(slot, multi_consumer()))
+			return NULL;
+		return this->data(slot);
 	}
-#endif //CIRCULAR_QUEUE_DISABLE_SAFE_POP
 
+	/*! \brief Destroy the item got from peekPop() and free its slot.
+	 * 
+	 * @param slot The slot from peekPop().
+	 */
+	void releasePop(boost::uint32_t slot){
+		freePopSlot(slot, multi_consumer());
+	}
 	/*! \brief Pop item from queue and return the popped item.
 	 * 
 	 * Use this, if you want to pop only from single thread, but push from multiple. (collect data)
 	 * 
-	 * @param item Item, where the popped item will be copied.
+	 * @param item Item, where the popped item will be moved.
 	 * @return True, when success. False, when queue is empty and signalNoMorePush() was called.
 	 */
 	bool popUnsafe(T &item){
-		boost::uint32_t mypos = mReadPos;
-		mReadPos++;
-		#ifdef CIRCULAR_QUEUE_VERBOSE
-			COUT_WRITE("pop " << mypos << std::endl);
-		#endif
-		mypos %= size;
-
-		//queue is empty, wait for data.
-		while(!mHasData[mypos]){
-			if(mNoMorePush)
-				return false;
-			CIRCULAR_QUEUE_WAIT();
-		}
-		
-		item = mData[mypos];
-		mHasData[mypos] = false;
+		boost::uint32_t mypos;
+		if(!claimPopSlot(mypos, boost::false_type()))
+			return false;
+		item = boost::move(*this->data(mypos));
+		freePopSlot(mypos, boost::false_type());
 		return true;
 	}
 	/*! \brief Pop item from queue and return the popped item.
@@ -277,19 +1656,59 @@ public:
 	 * @return The item popped.
 	 */
 	T popUnsafe(){
-		T data;
-		if(popUnsafe(data))
-			return data;
-		else
+		boost::uint32_t mypos;
+		if(!claimPopSlot(mypos, boost::false_type()))
 			throw exNoMorePush();
+		T data(boost::move(*this->data(mypos)));
+		freePopSlot(mypos, boost::false_type());
+		return data;
 	}
 	/*! \brief Close the queue for pushing.
 	 * 
 	 * When you don't want to push any more data, you can call this, and all threads waiting for data will return.
+	 * The queue is drained first: pushes, which have taken their position before this call, are still popped,
+	 * even when the pushing thread is still writing the item, so no item is lost.
+	 * Popping threads return false only, when no push has taken their position.
 	 * 
 	 */
 	void signalNoMorePush(){
-		mNoMorePush = true;
+		CIRCULAR_QUEUE_TRACE_EVENT(close, this->writePos().loadRelaxed(), 0);
+		mNoMorePush.storeRelease(true);
+		mParking.notify();
+	}
+	/*! \brief Checks, if signalNoMorePush() was called and all pushed items are popped.
+	 * 
+	 * Pushes, which have taken their position before signalNoMorePush(), are waited for.
+	 */
+	bool isDrained(){
+		return isDrainedAt(this->readPos().loadRelaxed());
+	}
+	/*! \brief Gets the parking of the queue, it is notified after every push and pop.
+	 * 
+	 * Used by circular_queue_set, to wake up a thread waiting on more queues.
+	 */
+	typename Wait::parking& getParking(){
+		return mParking;
+	}
+	/*! \brief Empty the queue and open it for pushing again.
+	 * 
+	 * Not thread-safe, no other thread may use the queue meanwhile.
+	 * The remaining items are destroyed, the positions and tickets are set back to zero and signalNoMorePush() is cleared,
+	 * so a closed queue can be reused without reallocation.
+	 * 
+	 */
+	void reset(){
+		for(boost::uint32_t i = 0; i < this->capacity(); i++){
+			if(this->hasData(i).loadRelaxed()){
+				this->data(i)->~T();
+				this->hasData(i).storeRelaxed(false);
+			}
+			resetPushTickets(i, multi_producer());
+			resetPopTickets(i, multi_consumer());
+		}
+		this->writePos().storeRelaxed(0);
+		this->readPos().storeRelaxed(0);
+		mNoMorePush.storeRelease(false);
 	}
 	/*! \brief Gets the estimated length of the queue
 	 * 
@@ -298,52 +1717,423 @@ public:
 	 * When push threads are waiting in a full queue, it will be bigger then size. 
 	 */
 	int getQueueLength(){
-		return (int)(mWritePos - mReadPos);
+		return (int)(position_diff_t)(this->writePos().loadRelaxed() - this->readPos().loadRelaxed());
+	}
+	/*! \brief Gets the number of pushed items in the queue, approximately.
+	 * 
+	 * Cheap enough for every routing decision, push and pop don't maintain anything for it.
+	 * Unlike getQueueLength(), it is never negative and never bigger than the capacity.
+	 * The positions are taken before the items are written, so the slots are checked at both ends:
+	 * it is 0, when the slot at the read position has no data (same as isEmpty()),
+	 * and the pushes at the write position, which are in progress, are not counted.
+	 * Items, which are being popped right now, may be counted.
+	 */
+	boost::uint32_t getSizeApprox(){
+		position_t readPos = this->readPos().loadRelaxed();
+		position_diff_t length = (position_diff_t)(this->writePos().loadRelaxed() - readPos);
+		if(length <= 0 || !this->hasData(this->index(readPos)).loadAcquire())
+			return 0;
+		if(length > (position_diff_t)this->capacity())
+			length = this->capacity();
+		//it only walks over the pushes in progress.
+		while(length > 1 && !this->hasData(this->index(readPos + length - 1)).loadAcquire())
+			length--;
+		return (boost::uint32_t)length;
+	}
+	/*! \brief Checks, if the next item to pop is pushed already.
+	 * 
+	 * Only the slot at the read position is checked, so it is true while its push is not finished,
+	 * even when later items are already pushed.
+	 */
+	bool isEmpty(){
+		return !this->hasData(this->index(this->readPos().loadRelaxed())).loadAcquire();
+	}
+	/*! \brief Checks, if the next push would wait for a free slot.
+	 * 
+	 * Only the slot at the write position is checked.
+	 */
+	bool isFull(){
+		return this->hasData(this->index(this->writePos().loadRelaxed())).loadAcquire();
+	}
+	/*! \brief Gets the number of slots in the queue.
+	 */
+	boost::uint32_t getCapacity() const {
+		return this->capacity();
+	}
+	/*! \brief Gets the wait counters and the high-water length, they are zeros with no_stats.
+	 * 
+	 * Thread-safe, use it to size the queue: ticket waits mean too small size for the number of threads,
+	 * full waits mean slow workers or too small size, empty waits mean idle workers.
+	 */
+	circular_queue_stats getStats() const {
+		return mStats.snapshot();
+	}
+	/*! \brief Sets the counters back to zero.
+	 * 
+	 * The counts of operations, which run meanwhile, may be lost.
+	 */
+	void resetStats(){
+		mStats.clear();
+	}
+protected:
+	//used by dynamic_circular_queue, the arguments are passed to the storage.
+	circular_queue(boost::uint32_t capacity, std::size_t alignment, const memory_placement &placement) :
+		circular_queue_detail::storage<T, size, Layout, Concurrency, Position>(capacity, alignment, placement)
+	{
 	}
 private:
-	/* Contains the queue items.
-	 * Setting mData to volatile will disable some optimizations in T class.
-	 * All compilers (what I've tested) will set mData before mHasData,
-	 * so it should be safe without volatile.
-	 */
-	/* volatile */ T mData[size]; // queue items
-	volatile bool mHasData[size]; // signal between push and pop threads
-	volatile boost::uint32_t mWritePos; // push position
-	volatile boost::uint32_t mReadPos; //pop position
-	volatile bool mNoMorePush; //
-
-#ifndef CIRCULAR_QUEUE_DISABLE_SAFE_PUSH
-	//ticket system works like a lock, but faster.
-	//when a thread want to push:
-	//	1. thread gets a ticket
-	//	2. waits for threads ticket in mPushTicket
-	//	3. waits for worker to process prev ticket.
-	//	3. pushes data
-	//	4. increases mPushTicket
-	volatile boost::uint32_t mPushQueue[size]; //get push ticket here
-	volatile boost::uint32_t mPushTicket[size]; //current active push ticket
-#endif
-#ifndef CIRCULAR_QUEUE_DISABLE_SAFE_POP
-	volatile boost::uint32_t mPopQueue[size]; //get push ticket here
-	volatile boost::uint32_t mPopTicket[size]; //current active push ticket
-#endif
+	typedef boost::integral_constant<bool, Concurrency::multiProducer> multi_producer;
+	typedef boost::integral_constant<bool, Concurrency::multiConsumer> multi_consumer;
+	typedef boost::integral_constant<bool, circular_queue_detail::storage<T, size, Layout, Concurrency, Position>::contiguous
+		&& circular_queue_detail::is_bulk_copyable<T>::value> bulk_copy;
+	//with more pushing threads the slots are published one by one, holding them while waiting for others could dead-lock on the tickets.
+	typedef boost::integral_constant<bool, bulk_copy::value && !Concurrency::multiProducer> bulk_push;
+	typedef typename Position::type position_t;
+	typedef typename Position::diff_type position_diff_t;
+
+	/* Pushing and popping is done in 3 steps:
+	 * 	1. claim: get a position and wait until the slot is ready for it
+	 * 	2. construct the item in the slot, or move it out and destroy it
+	 * 	3. publish/free: give the slot to the other side
+	 * Every step has a true_type version for multi-threaded side with tickets,
+	 * and a false_type version for single-threaded side, which is used by the unsafe methods too.
+	 */
+	position_t takeWritePos(boost::uint32_t count, boost::true_type){
+		return this->writePos().fetchAdd(count);
+	}
+	position_t takeWritePos(boost::uint32_t count, boost::false_type){
+		position_t pos = this->writePos().loadRelaxed();
+		this->writePos().storeRelaxed(pos + count);
+		return pos;
+	}
+	template <class MultiProducer>
+	boost::uint32_t claimPushSlot(MultiProducer multiProducer){
+		BOOST_ASSERT(!mNoMorePush.loadRelaxed());
+		position_t pos = takeWritePos(1, multiProducer);
+		CIRCULAR_QUEUE_COUNT_LENGTH((position_diff_t)(pos + 1 - this->readPos().loadRelaxed()));
+		
+		CIRCULAR_QUEUE_TRACE_EVENT(push, pos, 1);
+
+		Wait waiter(mParking);
+		return waitPushSlot(pos, waiter, multiProducer);
+	}
+	boost::uint32_t waitPushSlot(position_t pos, Wait &waiter, boost::true_type){
+		boost::uint32_t mypos = this->index(pos);
+		boost::uint32_t ticket = this->pushQueue(mypos).fetchAdd(1);
+
+		//another thread is pushing on the same queue item.
+		//happens, when a thread is doing a push() and the cpu is switched to other thread, which pushes 32 items, before the other thread can do the push.
+		//this is rare situation, you should increase size for speed-up, when this happens.
+		while(ticket != this->pushTicket(mypos).loadAcquire()){
+			CIRCULAR_QUEUE_COUNT(pushTicketWait);
+			waiter.wait();
+		}
+		return waitPushSlot(pos, waiter, boost::false_type());
+	}
+	boost::uint32_t waitPushSlot(position_t pos, Wait &waiter, boost::false_type){
+		boost::uint32_t mypos = this->index(pos);
+		//queue is full, wait for workers.
+		while(this->hasData(mypos).loadAcquire()){
+			CIRCULAR_QUEUE_COUNT(fullWait);
+			waiter.wait();
+		}
+		return mypos;
+	}
+	bool tryClaimPushSlot(boost::uint32_t &mypos, boost::true_type){
+		BOOST_ASSERT(!mNoMorePush.loadRelaxed());
+		position_t pos = this->writePos().loadRelaxed();
+		for(;;){
+			if(pushReady(pos)){
+				if(this->writePos().compareExchange(pos, pos + 1))
+					break;
+			} else {
+				position_t current = this->writePos().loadRelaxed();
+				if(current == pos)
+					return false;
+				pos = current;
+			}
+		}
+		mypos = this->index(pos);
+		CIRCULAR_QUEUE_COUNT_LENGTH((position_diff_t)(pos + 1 - this->readPos().loadRelaxed()));
+		CIRCULAR_QUEUE_TRACE_EVENT(push, pos, 1);
+
+		//nobody else can take a ticket on this slot before we are done.
+		boost::uint32_t ticket = this->pushQueue(mypos).fetchAdd(1);
+		BOOST_ASSERT(ticket == this->pushTicket(mypos).loadRelaxed());
+		(void)ticket;
+		return true;
+	}
+	bool tryClaimPushSlot(boost::uint32_t &mypos, boost::false_type){
+		BOOST_ASSERT(!mNoMorePush.loadRelaxed());
+		position_t pos = this->writePos().loadRelaxed();
+		mypos = this->index(pos);
+		//we are the only pusher, the slot is free when the data of the previous round is popped.
+		if(this->hasData(mypos).loadAcquire())
+			return false;
+		this->writePos().storeRelaxed(pos + 1);
+		CIRCULAR_QUEUE_COUNT_LENGTH((position_diff_t)(pos + 1 - this->readPos().loadRelaxed()));
+		CIRCULAR_QUEUE_TRACE_EVENT(push, pos, 1);
+		return true;
+	}
+	void publishPushSlot(boost::uint32_t mypos, boost::true_type){
+		this->hasData(mypos).storeRelease(true);
+		//only the ticket owner writes it, no need for atomic increment.
+		this->pushTicket(mypos).storeRelease(this->pushTicket(mypos).loadRelaxed() + 1);
+		mParking.notify();
+	}
+	void publishPushSlot(boost::uint32_t mypos, boost::false_type){
+		this->hasData(mypos).storeRelease(true);
+		mParking.notify();
+	}
+	//the slot is free for pos, when all pushes of the previous rounds are done and the data is popped.
+	bool pushReady(position_t pos){
+		boost::uint32_t mypos = this->index(pos);
+		return Position::isLap(this->pushTicket(mypos).loadAcquire(), pos, this->capacity()) && !this->hasData(mypos).loadAcquire();
+	}
+
+	bool claimPopSlot(boost::uint32_t &mypos, boost::true_type){
+		position_t pos = this->readPos().fetchAdd(1);
+		CIRCULAR_QUEUE_TRACE_EVENT(pop, pos, 1);
+		mypos = this->index(pos);
+		
+		boost::uint32_t ticket = this->popQueue(mypos).fetchAdd(1);
+		//the slot gives the items by ticket, an other thread may have taken the ticket of pos.
+		pos = Position::ticketPos(ticket, pos, this->capacity());
+
+		Wait waiter(mParking);
+		//another thread is popping on the same queue item.
+		//this is rare situation, you should increase size for speed-up, when this happens.
+		while(ticket != this->popTicket(mypos).loadAcquire()){
+			if(isDrainedAt(pos)){
+				CIRCULAR_QUEUE_COUNT(noMorePushExit);
+				return false;
+			}
+			CIRCULAR_QUEUE_COUNT(popTicketWait);
+			waiter.wait();
+		}
+
+		//queue is empty, wait for data.
+		while(!this->hasData(mypos).loadAcquire()){
+			if(isDrainedAt(pos)){
+				CIRCULAR_QUEUE_COUNT(noMorePushExit);
+				return false;
+			}
+			CIRCULAR_QUEUE_COUNT(emptyWait);
+			waiter.wait();
+		}
+		return true;
+	}
+	bool claimPopSlot(boost::uint32_t &mypos, boost::false_type){
+		position_t pos = this->readPos().loadRelaxed();
+		this->readPos().storeRelaxed(pos + 1);
+		CIRCULAR_QUEUE_TRACE_EVENT(pop, pos, 1);
+		mypos = this->index(pos);
+
+		Wait waiter(mParking);
+		//queue is empty, wait for data.
+		while(!this->hasData(mypos).loadAcquire()){
+			if(isDrainedAt(pos)){
+				CIRCULAR_QUEUE_COUNT(noMorePushExit);
+				return false;
+			}
+			CIRCULAR_QUEUE_COUNT(emptyWait);
+			waiter.wait();
+		}
+		return true;
+	}
+	//true, when signalNoMorePush() was called and no push has taken pos, so data will never come for it.
+	//a push, which has taken its position before signalNoMorePush(), is still waited for.
+	bool isDrainedAt(position_t pos){
+		if(!mNoMorePush.loadAcquire())
+			return false;
+		return (position_diff_t)(this->writePos().loadRelaxed() - pos) <= 0;
+	}
+	template <class MultiConsumer>
+	bool tryClaimPopSlot(boost::uint32_t &mypos, MultiConsumer multiConsumer){
+		position_t pos = this->readPos().loadRelaxed();
+		for(;;){
+			if(popReady(pos, multiConsumer)){
+				if(takeReadPos(pos, 1, multiConsumer))
+					break;
+			} else {
+				position_t current = this->readPos().loadRelaxed();
+				if(current == pos)
+					return false;
+				pos = current;
+			}
+		}
+		mypos = this->index(pos);
+		CIRCULAR_QUEUE_TRACE_EVENT(pop, pos, 1);
+		takePopTicket(mypos, multiConsumer);
+		return true;
+	}
+	//moves the read position from pos, returns false when other thread was faster.
+	bool takeReadPos(position_t &pos, boost::uint32_t count, boost::true_type){
+		return this->readPos().compareExchange(pos, pos + count);
+	}
+	bool takeReadPos(position_t &pos, boost::uint32_t count, boost::false_type){
+		this->readPos().storeRelaxed(pos + count);
+		return true;
+	}
+	//used, when the position is taken only for ready slot.
+	void takePopTicket(boost::uint32_t mypos, boost::true_type){
+		//nobody else can take a ticket on this slot before we are done.
+		boost::uint32_t ticket = this->popQueue(mypos).fetchAdd(1);
+		BOOST_ASSERT(ticket == this->popTicket(mypos).loadRelaxed());
+		(void)ticket;
+	}
+	void takePopTicket(boost::uint32_t, boost::false_type){ }
+	void resetPushTickets(boost::uint32_t mypos, boost::true_type){
+		this->pushQueue(mypos).storeRelaxed(0);
+		this->pushTicket(mypos).storeRelaxed(0);
+	}
+	void resetPushTickets(boost::uint32_t, boost::false_type){ }
+	void resetPopTickets(boost::uint32_t mypos, boost::true_type){
+		this->popQueue(mypos).storeRelaxed(0);
+		this->popTicket(mypos).storeRelaxed(0);
+	}
+	void resetPopTickets(boost::uint32_t, boost::false_type){ }
+	template <class MultiConsumer>
+	void freePopSlot(boost::uint32_t mypos, MultiConsumer multiConsumer){
+		clearPopSlot(mypos, multiConsumer);
+		mParking.notify();
+	}
+	void clearPopSlot(boost::uint32_t mypos, boost::true_type){
+		clearPopSlot(mypos, boost::false_type());
+		//only the ticket owner writes it, no need for atomic increment.
+		this->popTicket(mypos).storeRelease(this->popTicket(mypos).loadRelaxed() + 1);
+	}
+	void clearPopSlot(boost::uint32_t mypos, boost::false_type){
+		this->data(mypos)->~T();
+		this->hasData(mypos).storeRelease(false);
+	}
+	//the slot has data for pos, when all pops of the previous rounds are done and data is pushed.
+	bool popReady(position_t pos, boost::true_type){
+		boost::uint32_t mypos = this->index(pos);
+		return Position::isLap(this->popTicket(mypos).loadAcquire(), pos, this->capacity()) && this->hasData(mypos).loadAcquire();
+	}
+	bool popReady(position_t pos, boost::false_type){
+		return this->hasData(this->index(pos)).loadAcquire();
+	}
+	//waits for data, and takes the positions of the ready slots from pos, maximum count. Zero, when the queue is drained.
+	boost::uint32_t claimPopRange(position_t &pos, std::size_t count){
+		Wait waiter(mParking);
+		bool drained = false;
+		pos = this->readPos().loadRelaxed();
+		boost::uint32_t ready;
+		for(;;){
+			ready = 0;
+			while(ready < count && ready < this->capacity() && popReady(pos + ready, multi_consumer()))
+				ready++;
+
+			if(ready != 0){
+				if(takeReadPos(pos, ready, multi_consumer()))
+					break;
+			} else if(drained){
+				//queue was empty after signalNoMorePush(), and all taken pushes are popped.
+				CIRCULAR_QUEUE_COUNT(noMorePushExit);
+				return 0;
+			} else {
+				drained = isDrainedAt(pos);
+				if(!drained){
+					CIRCULAR_QUEUE_COUNT(emptyWait);
+					waiter.wait();
+				}
+				pos = this->readPos().loadRelaxed();
+			}
+		}
+
+		CIRCULAR_QUEUE_TRACE_EVENT(pop, pos, ready);
+		return ready;
+	}
+	void pushItems(const T *items, std::size_t count, boost::false_type){
+		push(items, items + count);
+	}
+	//the slots are waited and published one by one, only the data is copied in one step.
+	//Only for a single pushing thread, the free slots don't depend on other pushing threads.
+	void pushItems(const T *items, std::size_t count, boost::true_type){
+		BOOST_ASSERT(!mNoMorePush.loadRelaxed());
+		position_t pos = takeWritePos((boost::uint32_t)count, multi_producer());
+		CIRCULAR_QUEUE_COUNT_LENGTH((position_diff_t)(pos + count - this->readPos().loadRelaxed()));
+
+		CIRCULAR_QUEUE_TRACE_EVENT(push, pos, count);
+
+		Wait waiter(mParking);
+		while(count != 0){
+			//split at the end of the slot array.
+			boost::uint32_t first = this->index(pos);
+			boost::uint32_t chunk = this->capacity() - first;
+			if(count < chunk)
+				chunk = (boost::uint32_t)count;
+			for(boost::uint32_t i = 0; i < chunk; i++){
+				waitPushSlot(pos + i, waiter, multi_producer());
+			}
+			circular_queue_detail::copyItems(this->data(first), items, chunk);
+			for(boost::uint32_t i = 0; i < chunk; i++){
+				publishPushSlot(first + i, multi_producer());
+			}
+			pos += chunk;
+			items += chunk;
+			count -= chunk;
+		}
+	}
+	std::size_t popItems(T *out, std::size_t count, boost::false_type){
+		return pop<T*>(out, count);
+	}
+	std::size_t popItems(T *out, std::size_t count, boost::true_type){
+		position_t pos;
+		boost::uint32_t ready = claimPopRange(pos, count);
+		if(ready == 0)
+			return 0;
+		for(boost::uint32_t left = ready; left != 0; ){
+			boost::uint32_t first = this->index(pos);
+			boost::uint32_t chunk = this->capacity() - first;
+			if(left < chunk)
+				chunk = left;
+			for(boost::uint32_t i = 0; i < chunk; i++){
+				takePopTicket(first + i, multi_consumer());
+			}
+			std::memcpy(out, this->data(first), chunk * sizeof(T));
+			for(boost::uint32_t i = 0; i < chunk; i++){
+				clearPopSlot(first + i, multi_consumer());
+			}
+			pos += chunk;
+			out += chunk;
+			left -= chunk;
+		}
+		mParking.notify();
+		return ready;
+	}
+
+	circular_queue_detail::atomic<bool> mNoMorePush; //
+	typename Wait::parking mParking; //wakes up sleeping threads for park_wait
+	Stats mStats; //wait counters
 };
 
 //doxygen needs them defined, to include it in documentation.
 #ifdef DOXYGEN
-	//! Will write to cout every push and pop operation.
+	//! Will write to cout every push and pop operation, it selects cout_trace.
 	#define CIRCULAR_QUEUE_VERBOSE
 	
+	//! Record the events of the queues in per-thread rings, it selects ring_trace.
+	#define CIRCULAR_QUEUE_TRACE_RING
+	
+	//! Emit USDT probes for the events of the queues, it selects usdt_trace.
+	#define CIRCULAR_QUEUE_USDT
+	
+	//! The tracer class, its static event() function is called on every circular_queue_event.
+	#define CIRCULAR_QUEUE_TRACE
+	
+	//! The batch push of trivially copyable items writes the slots with non-temporal stores on x86.
+	#define CIRCULAR_QUEUE_STREAMING_STORES
+	
 	//! This will check in destructor, that the queue is empty.
 	#define CIRCULAR_QUEUE_SAFE_DELETE
 	
-	//! When you only use pushUnsafe(), you can disable push() to save memory.
-	#define CIRCULAR_QUEUE_DISABLE_SAFE_PUSH
-	
-	//! When you only use popUnsafe(), you can disable pop() to save memory.
-	#define CIRCULAR_QUEUE_DISABLE_SAFE_POP
+	//! Use volatile and boost::interprocess atomics, even when std::atomic is availible.
+	#define CIRCULAR_QUEUE_LEGACY_ATOMIC
 	
-	//!This is called, when the thread needs to wait
+	//! This is called by default_wait, when the thread needs to wait
 	#define CIRCULAR_QUEUE_WAIT()
 #endif
 
@@ -0,0 +1,92 @@
+#include "circular_queue.h"
+#include "sequence_circular_queue.h"
+#include "sharded_circular_queue.h"
+#include <boost/thread/thread.hpp>
+#include <boost/atomic.hpp>
+#include <iostream>
+#include <vector>
+#include <iterator>
+
+//batch pop test: a blocking batch pop with count 0 needs to return 0 at once, on an open queue with data too,
+//and the items need to stay in the queue.
+const int itemCount = 3;
+
+boost::atomic<int> result;
+
+//pops into an array or through an output iterator.
+template <typename Queue>
+void popArray(Queue *queue){
+	int out[itemCount];
+	result = (int)queue->pop(out, 0);
+}
+template <typename Queue>
+void popIterator(Queue *queue){
+	std::vector<int> out;
+	result = (int)queue->pop(std::back_inserter(out), 0);
+}
+
+template <typename Queue, class F>
+bool testZeroCount(const char *name, Queue &queue, F popZero){
+	result = -1;
+	boost::thread poppingThread(boost::bind(popZero, &queue));
+	if(!poppingThread.try_join_for(boost::chrono::seconds(5))){
+		//the thread can't be stopped, the process needs to exit.
+		std::cout << name << ": pop with count 0 is not returning" << std::endl;
+		return false;
+	}
+	if(result != 0){
+		std::cout << name << ": pop with count 0 returned " << result << std::endl;
+		return false;
+	}
+	std::vector<int> out;
+	if(queue.tryPop(std::back_inserter(out), itemCount) != itemCount){
+		std::cout << name << ": pop with count 0 has taken items" << std::endl;
+		return false;
+	}
+	return true;
+}
+
+template <typename Queue>
+bool testQueue(const char *name){
+	Queue queue;
+	bool ok = true;
+	for(int i = 0; i < itemCount; i++)
+		queue.push(i);
+	ok = ok && testZeroCount(name, queue, popArray<Queue>);
+	for(int i = 0; i < itemCount; i++)
+		queue.push(i);
+	ok = ok && testZeroCount(name, queue, popIterator<Queue>);
+	if(ok)
+		std::cout << name << ": ok" << std::endl;
+	return ok;
+}
+
+//circular_queue has no batch tryPop(), it is done with pop() of the items pushed.
+template <typename Queue>
+struct batch_try_pop : Queue {
+	template <class OutputIt>
+	std::size_t tryPop(OutputIt out, std::size_t count){
+		std::size_t popped = 0;
+		int item;
+		while(popped < count && Queue::tryPop(item)){
+			*out++ = item;
+			popped++;
+		}
+		return popped;
+	}
+};
+
+//pushes every item to the first shard.
+struct one_shard_queue : sharded_circular_queue<int, 8u> {
+	one_shard_queue() : sharded_circular_queue<int, 8u>(2) { }
+	void push(int item){
+		sharded_circular_queue<int, 8u>::push(0, item);
+	}
+};
+
+int main(){
+	bool ok = testQueue<batch_try_pop<circular_queue<int, 8u> > >("circular_queue");
+	ok = ok && testQueue<batch_try_pop<sequence_circular_queue<int, 8u> > >("sequence_circular_queue");
+	ok = ok && testQueue<one_shard_queue>("sharded_circular_queue");
+	return ok ? 0 : 1;
+}
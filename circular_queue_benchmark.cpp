@@ -0,0 +1,380 @@
+#include "circular_queue.h"
+#include "sequence_circular_queue.h"
+#include "spsc_circular_queue.h"
+#include <boost/thread/thread.hpp>
+#include <boost/thread/barrier.hpp>
+#include <boost/align/aligned_alloc.hpp>
+#include <boost/atomic.hpp>
+#include <boost/bind/bind.hpp>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string>
+#include <vector>
+#if defined(__linux__)
+	#include <pthread.h>
+	#include <sched.h>
+#elif defined(_WIN32)
+	#include <windows.h>
+#endif
+
+/* Benchmark for the queues, it replaces the 20x20 thread example as performance check.
+ *
+ * Every configuration (queue, layout, wait strategy, size, payload, producers, consumers) is run with
+ * the same number of items. Every item carries its push time, the consumers measure the push to pop latency
+ * in a log-linear histogram. The threads are pinned to cores, and one line is written per run,
+ * CSV by default or JSON lines with --json, so the results of two revisions can be compared.
+ *
+ * build: g++ -O2 -std=c++17 -I. circular_queue_benchmark.cpp -o circular_queue_benchmark -pthread -lboost_thread -lboost_chrono
+ *
+ * options:
+ * 	--items N          items per run (default 1000000)
+ * 	--producers 1,2,4  producer counts to sweep
+ * 	--consumers 1,2,4  consumer counts to sweep
+ * 	--filter text      run only the configurations, which name contains text, e.g. "padded/park_wait"
+ * 	                   spin_wait is skipped, when there are more threads than cores
+ * 	--no-pin           don't pin the threads to cores
+ * 	--json             JSON lines instead of CSV
+ */
+
+namespace {
+
+//the item, stamp is the push time in nanoseconds.
+template <std::size_t bytes>
+struct payload {
+	boost::uint64_t stamp;
+	char data[bytes - sizeof(boost::uint64_t)];
+};
+template <>
+struct payload<8u> {
+	boost::uint64_t stamp;
+};
+
+boost::uint64_t nowNs(){
+	return boost::chrono::duration_cast<boost::chrono::nanoseconds>(
+		circular_queue_detail::timeout_clock::now().time_since_epoch()).count();
+}
+
+/* Latency histogram with log-linear buckets, like HdrHistogram.
+ * Every power of two is divided into subCount buckets, so the error of a percentile is below 1/subCount.
+ */
+class latency_histogram {
+public:
+	static const unsigned subBits = 4u;
+	static const unsigned subCount = 1u << subBits;
+	static const unsigned bucketCount = (64u - subBits + 1u) * subCount;
+
+	latency_histogram() : mCount(0), mMax(0) {
+		std::memset(mBuckets, 0, sizeof(mBuckets));
+	}
+	void record(boost::uint64_t value){
+		mBuckets[bucketOf(value)]++;
+		mCount++;
+		if(value > mMax)
+			mMax = value;
+	}
+	void merge(const latency_histogram &other){
+		for(unsigned i = 0; i < bucketCount; i++)
+			mBuckets[i] += other.mBuckets[i];
+		mCount += other.mCount;
+		if(other.mMax > mMax)
+			mMax = other.mMax;
+	}
+	//lower bound of the bucket, where the percentile is.
+	boost::uint64_t percentile(double percent) const {
+		boost::uint64_t limit = (boost::uint64_t)(mCount * percent / 100.0);
+		boost::uint64_t seen = 0;
+		for(unsigned i = 0; i < bucketCount; i++){
+			seen += mBuckets[i];
+			if(seen > limit)
+				return valueOf(i);
+		}
+		return mMax;
+	}
+	boost::uint64_t count() const { return mCount; }
+	boost::uint64_t max() const { return mMax; }
+private:
+	static unsigned highestBit(boost::uint64_t value){
+	#if defined(__GNUC__)
+		return 63u - (unsigned)__builtin_clzll(value);
+	#else
+		unsigned bit = 0;
+		while(value >>= 1)
+			bit++;
+		return bit;
+	#endif
+	}
+	//values below subCount have their own bucket, the others are grouped by the highest bit and the next subBits bits.
+	static unsigned bucketOf(boost::uint64_t value){
+		if(value < subCount)
+			return (unsigned)value;
+		unsigned bit = highestBit(value);
+		return (bit - subBits + 1u) * subCount + (unsigned)(value >> (bit - subBits)) - subCount;
+	}
+	static boost::uint64_t valueOf(unsigned bucket){
+		if(bucket < subCount)
+			return bucket;
+		unsigned bit = bucket / subCount + subBits - 1u;
+		return (boost::uint64_t)(bucket % subCount + subCount) << (bit - subBits);
+	}
+
+	boost::uint64_t mBuckets[bucketCount];
+	boost::uint64_t mCount;
+	boost::uint64_t mMax;
+};
+
+struct options {
+	boost::uint64_t items;
+	std::vector<unsigned> producers;
+	std::vector<unsigned> consumers;
+	std::string filter;
+	bool pin;
+	bool json;
+};
+options gOptions;
+
+void pinThread(unsigned index){
+	if(!gOptions.pin)
+		return;
+	unsigned cpus = boost::thread::hardware_concurrency();
+	if(cpus == 0)
+		return;
+#if defined(__linux__)
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(index % cpus, &set);
+	pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#elif defined(_WIN32)
+	SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << (index % cpus));
+#endif
+}
+
+struct config {
+	const char *queue;
+	const char *layout;
+	const char *wait;
+	boost::uint32_t size;
+	std::size_t payload;
+	bool singleThreaded; //spsc queues run only with 1 producer and 1 consumer.
+};
+
+//one producer/consumer run on a queue.
+template <class Queue, class Item>
+class run {
+public:
+	run(unsigned producers, unsigned consumers) :
+		mProducers(producers),
+		mConsumers(consumers),
+		mStart(producers + consumers + 1),
+		mPopped(0)
+	{
+		//padded layouts need the alignment, operator new respects it only since C++17.
+		void *memory = boost::alignment::aligned_alloc(boost::alignment_of<Queue>::value, sizeof(Queue));
+		if(!memory)
+			throw std::bad_alloc();
+		mQueue = new (memory) Queue();
+		for(unsigned i = 0; i < consumers; i++)
+			mHistograms.push_back(new latency_histogram());
+	}
+	~run(){
+		for(std::size_t i = 0; i < mHistograms.size(); i++)
+			delete mHistograms[i];
+		mQueue->~Queue();
+		boost::alignment::aligned_free(mQueue);
+	}
+
+	//returns the elapsed seconds, the latencies are merged into histogram.
+	double execute(latency_histogram &histogram){
+		boost::thread_group producers, consumers;
+		for(unsigned i = 0; i < mConsumers; i++)
+			consumers.create_thread(boost::bind(&run::consume, this, i));
+		for(unsigned i = 0; i < mProducers; i++){
+			boost::uint64_t count = gOptions.items / mProducers;
+			if(gOptions.items % mProducers > i)
+				count++;
+			producers.create_thread(boost::bind(&run::produce, this, i, count));
+		}
+
+		mStart.wait();
+		boost::uint64_t start = nowNs();
+		producers.join_all();
+		mQueue->signalNoMorePush();
+		consumers.join_all();
+		boost::uint64_t end = nowNs();
+
+		for(unsigned i = 0; i < mConsumers; i++)
+			histogram.merge(*mHistograms[i]);
+		return (end - start) / 1e9;
+	}
+	boost::uint64_t popped() const { return mPopped; }
+private:
+	void produce(unsigned id, boost::uint64_t count){
+		boost::this_thread::disable_interruption di;
+		pinThread(id);
+		Item item;
+		std::memset(&item, 0, sizeof(item));
+		mStart.wait();
+		for(boost::uint64_t i = 0; i < count; i++){
+			item.stamp = nowNs();
+			mQueue->push(item);
+		}
+	}
+	void consume(unsigned id){
+		boost::this_thread::disable_interruption di;
+		pinThread(mProducers + id);
+		latency_histogram &histogram = *mHistograms[id];
+		Item item;
+		mStart.wait();
+		while(mQueue->pop(item))
+			histogram.record(nowNs() - item.stamp);
+		mPopped.fetch_add(histogram.count());
+	}
+
+	unsigned mProducers;
+	unsigned mConsumers;
+	Queue *mQueue;
+	boost::barrier mStart;
+	std::vector<latency_histogram*> mHistograms;
+	boost::atomic<boost::uint64_t> mPopped;
+};
+
+bool gFailed = false;
+
+void report(const config &cfg, unsigned producers, unsigned consumers, double seconds, const latency_histogram &histogram){
+	double opsPerSec = gOptions.items / seconds;
+	if(gOptions.json){
+		std::printf("{\"queue\":\"%s\",\"layout\":\"%s\",\"wait\":\"%s\",\"size\":%u,\"payload\":%u,"
+			"\"producers\":%u,\"consumers\":%u,\"items\":%llu,\"seconds\":%.6f,\"ops_per_sec\":%.0f,"
+			"\"p50_ns\":%llu,\"p90_ns\":%llu,\"p99_ns\":%llu,\"p999_ns\":%llu,\"max_ns\":%llu}\n",
+			cfg.queue, cfg.layout, cfg.wait, cfg.size, (unsigned)cfg.payload,
+			producers, consumers, (unsigned long long)gOptions.items, seconds, opsPerSec,
+			(unsigned long long)histogram.percentile(50.0), (unsigned long long)histogram.percentile(90.0),
+			(unsigned long long)histogram.percentile(99.0), (unsigned long long)histogram.percentile(99.9),
+			(unsigned long long)histogram.max());
+	} else {
+		std::printf("%s,%s,%s,%u,%u,%u,%u,%llu,%.6f,%.0f,%llu,%llu,%llu,%llu,%llu\n",
+			cfg.queue, cfg.layout, cfg.wait, cfg.size, (unsigned)cfg.payload,
+			producers, consumers, (unsigned long long)gOptions.items, seconds, opsPerSec,
+			(unsigned long long)histogram.percentile(50.0), (unsigned long long)histogram.percentile(90.0),
+			(unsigned long long)histogram.percentile(99.0), (unsigned long long)histogram.percentile(99.9),
+			(unsigned long long)histogram.max());
+	}
+	std::fflush(stdout);
+}
+
+//runs the queue with all producer and consumer counts.
+template <class Queue, class Item>
+void sweep(const config &cfg){
+	char name[256];
+	std::sprintf(name, "%s/%s/%s/%u/%u", cfg.queue, cfg.layout, cfg.wait, cfg.size, (unsigned)cfg.payload);
+	if(std::strstr(name, gOptions.filter.c_str()) == NULL)
+		return;
+
+	for(std::size_t p = 0; p < gOptions.producers.size(); p++){
+		for(std::size_t c = 0; c < gOptions.consumers.size(); c++){
+			unsigned producers = gOptions.producers[p];
+			unsigned consumers = gOptions.consumers[c];
+			if(cfg.singleThreaded && (producers != 1 || consumers != 1))
+				continue;
+			//spinning threads without their own core only wait for the preempted ones.
+			if(std::strcmp(cfg.wait, "spin_wait") == 0 && producers + consumers > boost::thread::hardware_concurrency()){
+				std::fprintf(stderr, "%s %ux%u: skipped, more threads than cores\n", name, producers, consumers);
+				continue;
+			}
+			std::fprintf(stderr, "%s %ux%u\n", name, producers, consumers);
+
+			latency_histogram histogram;
+			run<Queue, Item> bench(producers, consumers);
+			double seconds = bench.execute(histogram);
+			if(bench.popped() != gOptions.items){
+				std::fprintf(stderr, "%s %ux%u: popped %llu items of %llu\n", name, producers, consumers,
+					(unsigned long long)bench.popped(), (unsigned long long)gOptions.items);
+				gFailed = true;
+			}
+			report(cfg, producers, consumers, seconds, histogram);
+		}
+	}
+}
+
+template <class Item, boost::uint32_t size, class Wait>
+void sweepQueues(const char *wait){
+	config packed = { "circular_queue", "packed", wait, size, sizeof(Item), false };
+	sweep<circular_queue<Item, size, packed_layout, Wait>, Item>(packed);
+	config padded = { "circular_queue", "padded", wait, size, sizeof(Item), false };
+	sweep<circular_queue<Item, size, padded_layout, Wait>, Item>(padded);
+	config sequence = { "sequence_circular_queue", "packed", wait, size, sizeof(Item), false };
+	sweep<sequence_circular_queue<Item, size, packed_layout, Wait>, Item>(sequence);
+	config spsc = { "spsc_circular_queue", "-", wait, size, sizeof(Item), true };
+	sweep<spsc_circular_queue<Item, size, Wait>, Item>(spsc);
+}
+
+template <class Item, boost::uint32_t size>
+void sweepWaits(){
+	sweepQueues<Item, size, default_wait>("default_wait");
+	sweepQueues<Item, size, spin_wait>("spin_wait");
+	sweepQueues<Item, size, spin_yield_wait<> >("spin_yield_wait");
+	sweepQueues<Item, size, backoff_wait<> >("backoff_wait");
+	sweepQueues<Item, size, spin_sleep_wait<> >("spin_sleep_wait");
+	sweepQueues<Item, size, park_wait<> >("park_wait");
+}
+
+template <class Item>
+void sweepSizes(){
+	sweepWaits<Item, 16u>();
+	sweepWaits<Item, 1024u>();
+}
+
+std::vector<unsigned> parseList(const char *text){
+	std::vector<unsigned> result;
+	for(const char *p = text; *p; ){
+		char *end;
+		unsigned long value = std::strtoul(p, &end, 10);
+		if(end == p || value == 0){
+			std::fprintf(stderr, "bad thread count list: %s\n", text);
+			std::exit(2);
+		}
+		result.push_back((unsigned)value);
+		p = (*end == ',') ? end + 1 : end;
+	}
+	return result;
+}
+
+}
+
+int main(int argc, char **argv){
+	gOptions.items = 1000000;
+	gOptions.producers = parseList("1,2,4");
+	gOptions.consumers = parseList("1,2,4");
+	gOptions.pin = true;
+	gOptions.json = false;
+
+	for(int i = 1; i < argc; i++){
+		std::string arg = argv[i];
+		bool hasValue = i + 1 < argc;
+		if(arg == "--items" && hasValue){
+			gOptions.items = std::strtoull(argv[++i], NULL, 10);
+		} else if(arg == "--producers" && hasValue){
+			gOptions.producers = parseList(argv[++i]);
+		} else if(arg == "--consumers" && hasValue){
+			gOptions.consumers = parseList(argv[++i]);
+		} else if(arg == "--filter" && hasValue){
+			gOptions.filter = argv[++i];
+		} else if(arg == "--no-pin"){
+			gOptions.pin = false;
+		} else if(arg == "--json"){
+			gOptions.json = true;
+		} else {
+			std::fprintf(stderr, "usage: %s [--items N] [--producers 1,2,4] [--consumers 1,2,4] [--filter text] [--no-pin] [--json]\n", argv[0]);
+			return 2;
+		}
+	}
+
+	if(!gOptions.json)
+		std::printf("queue,layout,wait,size,payload,producers,consumers,items,seconds,ops_per_sec,p50_ns,p90_ns,p99_ns,p999_ns,max_ns\n");
+
+	sweepSizes<payload<8u> >();
+	sweepSizes<payload<64u> >();
+
+	return gFailed ? 1 : 0;
+}
@@ -0,0 +1,142 @@
+#include <boost/thread/thread.hpp>
+#include <boost/atomic.hpp>
+#include <cstdlib>
+
+//sleeps in some pops, so the threads are overtaken between taking the position and the slot.
+//circular_queue_event is declared in the header, so the event is a template, defined after it.
+struct sleepy_trace {
+	template <typename Event>
+	static void event(const void *queue, Event event, boost::uint64_t pos, boost::uint32_t count);
+};
+#define CIRCULAR_QUEUE_TRACE sleepy_trace
+#include "circular_queue.h"
+#include "sequence_circular_queue.h"
+#include "unbounded_circular_queue.h"
+#include "interprocess_circular_queue.h"
+#include "byte_circular_queue.h"
+#include "priority_circular_queue.h"
+#include <iostream>
+
+template <typename Event>
+void sleepy_trace::event(const void *, Event event, boost::uint64_t, boost::uint32_t){
+	if(event == circular_queue_event::pop && (rand() & 3) == 0)
+		boost::this_thread::sleep_for(boost::chrono::microseconds(rand() % 300));
+}
+
+//close/drain test: more popping threads than slots, a few items, then signalNoMorePush().
+//every pushed item needs to be popped once and every popping thread needs to return.
+//the same queue is used with reset() in every round.
+const int roundCount = 300;
+const int poppingThreadCount = 8;
+const int maxItems = 7;
+
+boost::atomic<int> popped;
+boost::atomic<int> sum;
+
+template <typename Queue>
+void popData(Queue *queue){
+	int item;
+	while(queue->pop(item)){
+		popped++;
+		sum += item;
+	}
+}
+template <typename Queue>
+bool testDrain(const char *name){
+	Queue queue;
+	for(int round = 0; round < roundCount; round++){
+		popped = 0;
+		sum = 0;
+		boost::thread* poppingThreads[poppingThreadCount];
+		for(int i = 0; i < poppingThreadCount; i++)
+			poppingThreads[i] = new boost::thread(boost::bind(popData<Queue>, &queue));
+
+		int items = round % (maxItems + 1);
+		for(int i = 1; i <= items; i++)
+			queue.push(i);
+		queue.signalNoMorePush();
+
+		bool hang = false;
+		for(int i = 0; i < poppingThreadCount; i++){
+			if(!poppingThreads[i]->try_join_for(boost::chrono::seconds(5))){
+				//the thread can't be stopped, the process needs to exit.
+				hang = true;
+				break;
+			}
+			delete poppingThreads[i];
+		}
+		if(hang){
+			std::cout << name << ": popping thread is not returning in round " << round << std::endl;
+			return false;
+		}
+		if(popped != items || sum != items * (items + 1) / 2){
+			std::cout << name << ": popped " << popped << " of " << items << " items in round " << round << std::endl;
+			return false;
+		}
+		queue.reset();
+	}
+	std::cout << name << ": ok" << std::endl;
+	return true;
+}
+
+//pushes the items to both levels.
+struct two_level_queue : priority_circular_queue<int, 2u, 2u> {
+	void push(int item){
+		priority_circular_queue<int, 2u, 2u>::push(item % 2, item);
+	}
+};
+
+//close while reserved: the records are reserved before signalNoMorePush() and committed after it,
+//the consumer needs to wait for them.
+typedef byte_circular_queue<256u> byte_queue;
+
+void popRecords(byte_queue *queue){
+	boost::uint32_t length;
+	while(const void *data = queue->peekPop(length)){
+		int item;
+		std::memcpy(&item, data, sizeof(item));
+		popped++;
+		sum += item;
+		queue->releasePop();
+	}
+}
+bool testReservedDrain(const char *name){
+	byte_queue queue;
+	for(int round = 0; round < roundCount; round++){
+		popped = 0;
+		sum = 0;
+		int items = round % (maxItems + 1);
+		boost::uint32_t records[maxItems];
+		for(int i = 1; i <= items; i++){
+			void *payload = queue.reservePush(sizeof(int), records[i - 1]);
+			std::memcpy(payload, &i, sizeof(int));
+		}
+		boost::thread poppingThread(boost::bind(popRecords, &queue));
+		queue.signalNoMorePush();
+		//the consumer finds the queue empty and closed.
+		boost::this_thread::sleep_for(boost::chrono::microseconds(rand() % 300));
+		for(int i = 0; i < items; i++)
+			queue.commitPush(records[i]);
+
+		if(!poppingThread.try_join_for(boost::chrono::seconds(5))){
+			std::cout << name << ": popping thread is not returning in round " << round << std::endl;
+			return false;
+		}
+		if(popped != items || sum != items * (items + 1) / 2){
+			std::cout << name << ": popped " << popped << " of " << items << " records in round " << round << std::endl;
+			return false;
+		}
+		queue.reset();
+	}
+	std::cout << name << ": ok" << std::endl;
+	return true;
+}
+int main(){
+	bool ok = testDrain<circular_queue<int, 2u> >("circular_queue");
+	ok = ok && testDrain<sequence_circular_queue<int, 2u> >("sequence_circular_queue");
+	ok = ok && testDrain<unbounded_circular_queue<int, 2u> >("unbounded_circular_queue");
+	ok = ok && testDrain<interprocess_circular_queue<int, 2u> >("interprocess_circular_queue");
+	ok = ok && testDrain<two_level_queue>("priority_circular_queue");
+	ok = ok && testReservedDrain("byte_circular_queue");
+	return ok ? 0 : 1;
+}
@@ -4,6 +4,7 @@
 
 //extreme test: pushing and popping 10million items,
 //with 20 pushing and 20 popping thread(total of 40 threads) on a 16 item circular queue. :)
+//for performance measurements use circular_queue_benchmark.cpp.
 const int pushValue = 1;
 const int taskCount = 10000000;
 const int pushingThreadCount = 20;
@@ -57,5 +58,5 @@ int main(){
 	
 	std::cout << "Value should be:  " << pushValue * taskCount << std::endl;
 	std::cout << "Calculated value: " << final_result << std::endl;
-	std::cin.get();
+	return final_result == pushValue * taskCount ? 0 : 1;
 }
@@ -0,0 +1,85 @@
+#include "broadcast_circular_queue.h"
+#include <iostream>
+
+//exception test: the copy constructor of the item throws in push(),
+//every constructed item needs to be destroyed once, and the queue needs to stay usable.
+struct exCopy { };
+
+//counts the living instances, the copy constructor throws, when throwNext is set.
+struct counted {
+	static int instances;
+	static bool throwNext;
+	int value;
+
+	explicit counted(int v) : value(v) { instances++; }
+	counted(const counted &other) : value(other.value) {
+		if(throwNext){
+			throwNext = false;
+			throw exCopy();
+		}
+		instances++;
+	}
+	counted& operator=(const counted &other){
+		value = other.value;
+		return *this;
+	}
+	~counted(){ instances--; }
+};
+int counted::instances = 0;
+bool counted::throwNext = false;
+
+typedef broadcast_circular_queue<counted, 4u> broadcast_queue;
+
+//pushes, which throw, either with push() or tryPush().
+bool throwingPush(broadcast_queue &queue, int value, bool tryPush){
+	counted item(value);
+	counted::throwNext = true;
+	try {
+		if(tryPush)
+			queue.tryPush(item);
+		else
+			queue.push(item);
+	} catch(exCopy&) {
+		return true;
+	}
+	return false;
+}
+
+//wraps is the number of items pushed and popped before the throwing push, so the ring can be full of old items.
+bool testBroadcast(const char *name, int wraps, bool tryPush){
+	{
+		broadcast_queue queue(1);
+		boost::uint32_t consumer = queue.addConsumer();
+		counted item(0);
+		for(int i = 0; i < wraps; i++){
+			queue.push(counted(i));
+			queue.pop(consumer, item);
+		}
+		if(!throwingPush(queue, -1, tryPush)){
+			std::cout << name << ": push didn't throw after " << wraps << " items" << std::endl;
+			return false;
+		}
+		//the failed push is not visible, and the next one takes its slot.
+		queue.push(counted(wraps));
+		if(!queue.tryPop(consumer, item) || item.value != wraps || !queue.isEmpty(consumer)){
+			std::cout << name << ": wrong item after the failed push after " << wraps << " items" << std::endl;
+			return false;
+		}
+	}
+	if(counted::instances != 0){
+		std::cout << name << ": " << counted::instances << " instances left after " << wraps << " items" << std::endl;
+		return false;
+	}
+	return true;
+}
+
+int main(){
+	bool ok = true;
+	for(int wraps = 0; wraps < 10 && ok; wraps++){
+		ok = testBroadcast("broadcast_circular_queue push()", wraps, false);
+		ok = ok && testBroadcast("broadcast_circular_queue tryPush()", wraps, true);
+	}
+	if(ok)
+		std::cout << "broadcast_circular_queue: ok" << std::endl;
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,199 @@
+/**
+ * @file
+ * @author Peter Szucs <peter.szucs.dev@gmail.com>
+ *
+ * @section LICENSE
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @class circular_queue_set
+ * \brief Waits on more queues at once, and pops the first item availible.
+ * 
+ * Use this, when a consumer serves more queues (e.g. priority lanes), and it would poll them otherwise.
+ * The queues need to use park_wait, the set links their parking to its own, so every push wakes up the waiting thread,
+ * and it checks all queues with tryPop() only then. The queues are checked in the order they were added,
+ * so the first queue has priority.
+ * Queues of different type can be in the same set: circular_queue, dynamic_circular_queue, sequence_circular_queue
+ * and spsc_circular_queue, with the same item type.
+ *
+ * example: circular_queue<job, 64, packed_layout, park_wait<> > high, low; circular_queue_set<job> lanes; lanes.add(high); lanes.add(low);
+ * 	then lanes.pop(item, lane) in the worker threads.
+ */
+
+#ifndef CIRCULAR_QUEUE_SET_H
+#define CIRCULAR_QUEUE_SET_H
+
+#include "circular_queue.h"
+#include <vector>
+
+/*! \brief Set of queues, which can be popped together.
+ * 
+ * Add the queues before popping, and keep them alive, while the set exists.
+ * The set is thread-safe for popping, any number of threads can pop from it and from the queues directly.
+ * 
+ * @tparam T Type of the items.
+ * @tparam Wait Wait strategy of the popping threads, it needs park_wait parking.
+ */
+template <typename T, typename Wait = park_wait<> >
+class circular_queue_set {
+public:
+	circular_queue_set() { }
+
+	~circular_queue_set(){
+		for(std::size_t i = 0; i < mQueues.size(); i++){
+			mQueues[i].parking->link(NULL);
+		}
+	}
+
+	/*! \brief Adds a queue to the set.
+	 * 
+	 * Not thread-safe, add the queues before popping. A queue can be only in one set.
+	 * 
+	 * @param queue The queue, it needs to use park_wait.
+	 * @return Index of the queue, pop() returns it with the item.
+	 */
+	template <class Queue>
+	std::size_t add(Queue &queue){
+		entry e;
+		e.queue = &queue;
+		e.tryPop = &tryPopQueue<Queue>;
+		e.isDrained = &isQueueDrained<Queue>;
+		e.parking = &queue.getParking();
+		BOOST_ASSERT(e.parking->linked() == NULL);
+		e.parking->link(&mParking);
+		mQueues.push_back(e);
+		return mQueues.size() - 1;
+	}
+
+	/*! \brief Pop item from the first queue, which has data.
+	 * 
+	 * Waits until any of the queues has data.
+	 * 
+	 * @param item Item, where the popped item will be moved.
+	 * @param index Set to the index of the queue, where the item came from.
+	 * @return True, when success. False, when all queues are empty and signalNoMorePush() was called on all of them.
+	 */
+	bool pop(T &item, std::size_t &index){
+		Wait waiter(mParking);
+		while(!tryPop(item, index)){
+			if(isDrained())
+				//items pushed meanwhile are still popped.
+				return tryPop(item, index);
+			waiter.wait();
+		}
+		return true;
+	}
+
+	/*! \brief Pop item from the first queue, which has data.
+	 * 
+	 * Same as pop(T&, std::size_t&), without the index.
+	 */
+	bool pop(T &item){
+		std::size_t index;
+		return pop(item, index);
+	}
+
+	/*! \brief Pop item from the first queue, which has data, when it can be done without waiting.
+	 * 
+	 * @param item Item, where the popped item will be moved.
+	 * @param index Set to the index of the queue, where the item came from.
+	 * @return True, when success. False, when all queues are empty.
+	 */
+	bool tryPop(T &item, std::size_t &index){
+		for(std::size_t i = 0; i < mQueues.size(); i++){
+			if(mQueues[i].tryPop(mQueues[i].queue, item)){
+				index = i;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	/*! \brief Pop item from the first queue, which has data, wait until there is data or the timeout expires.
+	 * 
+	 * @param item Item, where the popped item will be moved.
+	 * @param index Set to the index of the queue, where the item came from.
+	 * @param relTime Maximum time to wait.
+	 * @return True, when success. False, when the timeout expired or all queues are drained.
+	 */
+	template <class Rep, class Period>
+	bool popFor(T &item, std::size_t &index, const boost::chrono::duration<Rep, Period> &relTime){
+		return popUntil(item, index, circular_queue_detail::timeout_clock::now() + relTime);
+	}
+
+	/*! \brief Pop item from the first queue, which has data, wait until there is data or the deadline.
+	 * 
+	 * @param item Item, where the popped item will be moved.
+	 * @param index Set to the index of the queue, where the item came from.
+	 * @param absTime Deadline.
+	 * @return True, when success. False, when the deadline is reached or all queues are drained.
+	 */
+	template <class Clock, class Duration>
+	bool popUntil(T &item, std::size_t &index, const boost::chrono::time_point<Clock, Duration> &absTime){
+		Wait waiter(mParking);
+		while(!tryPop(item, index)){
+			if(isDrained())
+				return tryPop(item, index);
+			if(Clock::now() >= absTime)
+				return false;
+			waiter.wait();
+		}
+		return true;
+	}
+
+	/*! \brief Checks, if signalNoMorePush() was called on all queues, and all items are popped.
+	 */
+	bool isDrained(){
+		for(std::size_t i = 0; i < mQueues.size(); i++){
+			if(!mQueues[i].isDrained(mQueues[i].queue))
+				return false;
+		}
+		return true;
+	}
+
+	/*! \brief Gets the number of queues in the set.
+	 */
+	std::size_t getQueueCount() const {
+		return mQueues.size();
+	}
+private:
+	circular_queue_set(const circular_queue_set&);
+	circular_queue_set& operator=(const circular_queue_set&);
+
+	//the queues are called through these, so queues of different type can be in the set.
+	struct entry {
+		void *queue;
+		bool (*tryPop)(void *queue, T &item);
+		bool (*isDrained)(void *queue);
+		circular_queue_detail::parking_lot *parking;
+	};
+	template <class Queue>
+	static bool tryPopQueue(void *queue, T &item){
+		return static_cast<Queue*>(queue)->tryPop(item);
+	}
+	template <class Queue>
+	static bool isQueueDrained(void *queue){
+		return static_cast<Queue*>(queue)->isDrained();
+	}
+
+	std::vector<entry> mQueues;
+	typename Wait::parking mParking; //notified by the parking of the queues
+};
+
+#endif //CIRCULAR_QUEUE_SET_H
@@ -0,0 +1,89 @@
+#include "unbounded_circular_queue.h"
+#include <boost/thread/thread.hpp>
+#include <boost/atomic.hpp>
+#include <iostream>
+
+//stress test of the segment recycling of unbounded_circular_queue:
+//2 slot segments and maximum 4 of them, so they are unlinked and reused all the time, and more threads than cores,
+//so the threads are often preempted with a stale head or tail segment.
+//one pushing thread, so every popping thread needs to get increasing items (FIFO),
+//and tryPop() may never wait.
+const int roundCount = 20;
+const int itemCount = 200000;
+const int poppingThreadCount = 4;
+const int tryPoppingThreadCount = 4;
+
+typedef unbounded_circular_queue<int, 2u> queue_type;
+queue_type *tasks;
+boost::atomic<int> popped;
+boost::atomic<bool> failed;
+boost::atomic<bool> pushed;
+
+void checkOrder(int item, int &last){
+	if(item <= last)
+		failed = true;
+	last = item;
+	popped++;
+}
+void popData(){
+	int item;
+	int last = -1;
+	while(tasks->pop(item))
+		checkOrder(item, last);
+}
+void tryPopData(){
+	int item;
+	int last = -1;
+	while(!pushed){
+		if(tasks->tryPop(item))
+			checkOrder(item, last);
+		else
+			boost::this_thread::yield();
+	}
+	//the rest, which is not taken by the blocking threads.
+	while(tasks->tryPop(item))
+		checkOrder(item, last);
+}
+//the threads, which don't return, can't be stopped, the process needs to exit.
+bool joinAll(boost::thread **threads, int count){
+	for(int i = 0; i < count; i++){
+		if(!threads[i]->try_join_for(boost::chrono::seconds(10)))
+			return false;
+		delete threads[i];
+	}
+	return true;
+}
+int main(){
+	queue_type queue(4);
+	tasks = &queue;
+	for(int round = 0; round < roundCount; round++){
+		popped = 0;
+		pushed = false;
+		boost::thread* poppingThreads[poppingThreadCount + tryPoppingThreadCount];
+		for(int i = 0; i < poppingThreadCount; i++)
+			poppingThreads[i] = new boost::thread(popData);
+		for(int i = 0; i < tryPoppingThreadCount; i++)
+			poppingThreads[poppingThreadCount + i] = new boost::thread(tryPopData);
+
+		for(int i = 0; i < itemCount; i++)
+			queue.push(i);
+		pushed = true;
+		queue.signalNoMorePush();
+
+		if(!joinAll(poppingThreads, poppingThreadCount + tryPoppingThreadCount)){
+			std::cout << "unbounded_circular_queue: popping thread is not returning in round " << round << std::endl;
+			return 1;
+		}
+		if(failed){
+			std::cout << "unbounded_circular_queue: items are popped out of order in round " << round << std::endl;
+			return 1;
+		}
+		if(popped != itemCount){
+			std::cout << "unbounded_circular_queue: popped " << popped << " of " << itemCount << " items in round " << round << std::endl;
+			return 1;
+		}
+		queue.reset();
+	}
+	std::cout << "unbounded_circular_queue: ok" << std::endl;
+	return 0;
+}
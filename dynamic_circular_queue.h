@@ -0,0 +1,172 @@
+/**
+ * @file
+ * @author Peter Szucs <peter.szucs.dev@gmail.com>
+ *
+ * @section LICENSE
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @class dynamic_circular_queue
+ * \brief circular_queue with capacity chosen at construction.
+ * 
+ * Same as circular_queue, but the slots are allocated on the heap, so you don't need a new
+ * template instance for every size, and the queue depth can be set from configuration.
+ * The capacity is rounded up to power of two, so the position is converted to slot with mask.
+ * 
+ * With packed_layout the data, flag and tickets of a slot are stored next to each other,
+ * with padded_layout every slot is on its own cache line.
+ * The items are not next to each other in either layout, so the batches are not copied with memcpy(),
+ * like in circular_queue with packed_layout, every item is copied on its own.
+ *
+ * example: see circular_queue_example.cpp, it works the same with dynamic_circular_queue<int> tasks(16).
+ */
+
+#ifndef DYNAMIC_CIRCULAR_QUEUE_H
+#define DYNAMIC_CIRCULAR_QUEUE_H
+
+#include "circular_queue.h"
+#include <stdexcept> //invalid_argument, length_error
+
+namespace circular_queue_detail {
+	//smallest power of two, which is not less than value.
+	inline boost::uint32_t roundUpToPowerOfTwo(boost::uint32_t value){
+		BOOST_ASSERT(value <= 0x80000000u);
+		boost::uint32_t result = 1;
+		while(result < value)
+			result <<= 1;
+		return result;
+	}
+
+	//heap allocated slots for dynamic_circular_queue.
+	template <typename T, typename Layout, typename Concurrency, typename Position>
+	class dynamic_storage {
+	protected:
+		typedef typename Position::type position_t;
+
+		//the items are in the cells with the flags.
+		static const bool contiguous = false;
+
+		dynamic_storage(boost::uint32_t capacity, std::size_t alignment, const memory_placement &placement) :
+			mMask(roundUpToPowerOfTwo(checkCapacity(capacity)) - 1),
+			mPlacement(placement)
+		{
+			if(alignment < boost::alignment_of<cell>::value)
+				alignment = boost::alignment_of<cell>::value;
+			mSlots = static_cast<cell*>(mPlacement.allocate(sizeof(cell) * (mMask + 1), alignment));
+			for(boost::uint32_t i = 0; i <= mMask; i++){
+				new (&mSlots[i]) cell();
+			}
+		}
+		//throws on the capacities, which can't be rounded up to power of two.
+		static boost::uint32_t checkCapacity(boost::uint32_t capacity){
+			if(capacity == 0)
+				throw std::invalid_argument("dynamic_circular_queue: capacity is 0");
+			if(capacity > 0x80000000u)
+				throw std::length_error("dynamic_circular_queue: capacity is more than 0x80000000");
+			return capacity;
+		}
+		~dynamic_storage(){
+			for(boost::uint32_t i = 0; i <= mMask; i++){
+				mSlots[i].~cell();
+			}
+			mPlacement.deallocate(mSlots, sizeof(cell) * (mMask + 1));
+		}
+
+		boost::uint32_t capacity() const { return mMask + 1; }
+		boost::uint32_t index(position_t pos) const { return (boost::uint32_t)pos & mMask; }
+		T* data(boost::uint32_t pos){ return mSlots[pos].value.data.get(); }
+		atomic<bool>& hasData(boost::uint32_t pos){ return mSlots[pos].value.hasData; }
+		atomic<position_t>& writePos(){ return mWritePos.value; }
+		atomic<position_t>& readPos(){ return mReadPos.value; }
+		atomic<boost::uint32_t>& pushQueue(boost::uint32_t pos){ return mSlots[pos].value.pushQueue; }
+		atomic<boost::uint32_t>& pushTicket(boost::uint32_t pos){ return mSlots[pos].value.pushTicket; }
+		atomic<boost::uint32_t>& popQueue(boost::uint32_t pos){ return mSlots[pos].value.popQueue; }
+		atomic<boost::uint32_t>& popTicket(boost::uint32_t pos){ return mSlots[pos].value.popTicket; }
+	private:
+		dynamic_storage(const dynamic_storage&);
+		dynamic_storage& operator=(const dynamic_storage&);
+
+		typedef layout_cell<ticket_slot<T, Concurrency>, Layout> cell;
+
+		cell *mSlots;
+		const boost::uint32_t mMask; // capacity - 1
+		const memory_placement mPlacement; // where mSlots is allocated
+		layout_cell<atomic<position_t>, Layout> mWritePos; // push position
+		layout_cell<atomic<position_t>, Layout> mReadPos; // pop position
+	};
+
+	//size 0 means dynamic size.
+	template <typename T, typename Concurrency, typename Position>
+	class storage<T, 0u, packed_layout, Concurrency, Position> : public dynamic_storage<T, packed_layout, Concurrency, Position> {
+	protected:
+		storage(boost::uint32_t capacity, std::size_t alignment, const memory_placement &placement) :
+			dynamic_storage<T, packed_layout, Concurrency, Position>(capacity, alignment, placement)
+		{
+		}
+	};
+	template <typename T, typename Concurrency, typename Position>
+	class storage<T, 0u, padded_layout, Concurrency, Position> : public dynamic_storage<T, padded_layout, Concurrency, Position> {
+	protected:
+		storage(boost::uint32_t capacity, std::size_t alignment, const memory_placement &placement) :
+			dynamic_storage<T, padded_layout, Concurrency, Position>(capacity, alignment, placement)
+		{
+		}
+	};
+}
+
+/*! \brief The circular queue with runtime capacity.
+ * 
+ * @tparam T Type of the items.
+ * @tparam Layout Memory layout of the slots: packed_layout or padded_layout.
+ * @tparam Wait Wait strategy: default_wait, spin_wait, spin_yield_wait, backoff_wait, spin_sleep_wait or park_wait.
+ * @tparam Concurrency Number of pushing and popping threads: mpmc, mpsc, spmc or spsc.
+ * @tparam Position Width of the push and pop positions: position32 or position64.
+ * @tparam Stats Wait counters: no_stats or sharded_stats.
+ */
+template <typename T, typename Layout = packed_layout, typename Wait = default_wait, typename Concurrency = mpmc, typename Position = position32,
+	typename Stats = no_stats>
+class dynamic_circular_queue : public circular_queue<T, 0u, Layout, Wait, Concurrency, Position, Stats> {
+public:
+	/*! \brief Creates the queue.
+	 * 
+	 * @param capacity Number of slots, it will be rounded up to power of two. Maximum is 0x80000000,
+	 * throws std::invalid_argument for 0 and std::length_error above the maximum.
+	 * @param alignment Alignment of the slot array, e.g. page size. Minimum is the alignment of the slots.
+	 */
+	explicit dynamic_circular_queue(boost::uint32_t capacity, std::size_t alignment = CIRCULAR_QUEUE_CACHE_LINE_SIZE) :
+		circular_queue<T, 0u, Layout, Wait, Concurrency, Position, Stats>(capacity, alignment, memory_placement())
+	{
+	}
+
+	/*! \brief Creates the queue, with the slots on a NUMA node.
+	 * 
+	 * The positions are in the queue object, allocate it on the node too, or construct it on a thread of the node.
+	 * 
+	 * @param capacity Number of slots, it will be rounded up to power of two. Maximum is 0x80000000,
+	 * throws std::invalid_argument for 0 and std::length_error above the maximum.
+	 * @param placement NUMA node and page size of the slot array, e.g. memory_placement(memory_placement::currentNode(), true).
+	 * @param alignment Alignment of the slot array. Minimum is the alignment of the slots.
+	 */
+	dynamic_circular_queue(boost::uint32_t capacity, const memory_placement &placement, std::size_t alignment = CIRCULAR_QUEUE_CACHE_LINE_SIZE) :
+		circular_queue<T, 0u, Layout, Wait, Concurrency, Position, Stats>(capacity, alignment, placement)
+	{
+	}
+};
+
+#endif //DYNAMIC_CIRCULAR_QUEUE_H
@@ -0,0 +1,244 @@
+/**
+ * @file
+ * @author Peter Szucs <peter.szucs.dev@gmail.com>
+ *
+ * @section LICENSE
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @class interprocess_circular_queue
+ * \brief Multi-producer/multi-consumer queue for shared memory between processes.
+ * 
+ * The queue can be placed in a boost::interprocess managed_shared_memory or managed_mapped_file segment.
+ * All state is inside the object (no pointers, no virtual functions), so it works,
+ * when the processes map the segment to different addresses.
+ * The slot protocol is shared with sequence_circular_queue, every slot has a sequence number.
+ * Items are copied into the shared memory at push and copied out at pop, so T needs to be trivially copyable.
+ * For zero copies, write the item in place with reservePush() and commitPush(),
+ * and read it in place with peekPop() and releasePop().
+ * 
+ * A process can attach any time, the positions are in the shared memory, so it will continue where the others are.
+ * Use find_or_construct(), it creates the queue only in the first process:
+ * 	managed_shared_memory segment(open_or_create, "frames", 1 << 20);
+ * 	interprocess_circular_queue<frame, 1024> *queue = segment.find_or_construct< interprocess_circular_queue<frame, 1024> >("queue")();
+ * 	if(!queue->isCompatible()) ... //created by a different build
+ * 
+ * Only wait strategies without parking can be used (default_wait, spin_wait, spin_yield_wait, backoff_wait, spin_sleep_wait),
+ * park_wait would sleep on a process local futex or condition variable.
+ * The atomics need to be lock-free (address-free), which is true for 32 bit integers on all common platforms.
+ *
+ * example: see circular_queue_example.cpp, with the pushing and popping threads in different processes.
+ */
+
+#ifndef INTERPROCESS_CIRCULAR_QUEUE_H
+#define INTERPROCESS_CIRCULAR_QUEUE_H
+
+#include "sequence_circular_queue.h"
+#include <boost/type_traits/is_same.hpp>
+#include <boost/type_traits/is_trivially_copyable.hpp>
+
+/*! \brief The interprocess circular queue.
+ * 
+ * @tparam T Type of the items, needs to be trivially copyable, without pointers to process local memory.
+ * @tparam size Number of slots, needs to be power of two.
+ * @tparam Wait Wait strategy without parking: default_wait, spin_wait, spin_yield_wait, backoff_wait or spin_sleep_wait.
+ */
+template <typename T, boost::uint32_t size = 32u, typename Wait = default_wait>
+class interprocess_circular_queue : private circular_queue_detail::sequence_slots<T, size, padded_layout, Wait> {
+public:
+	interprocess_circular_queue() :
+		mMagic(magic),
+		mCapacity(size),
+		mItemSize(sizeof(T))
+	{
+		//items are copied by the other process, they can't own resources.
+		BOOST_STATIC_ASSERT( boost::is_trivially_copyable<T>::value );
+		//the parking of park_wait is not shared between processes.
+		BOOST_STATIC_ASSERT( (boost::is_same<typename Wait::parking, circular_queue_detail::no_parking>::value) );
+
+		mReady.storeRelease(true);
+	}
+
+	/*! \brief Checks, that the queue in shared memory is created with the same parameters.
+	 * 
+	 * Call it after attaching, when the processes can be different builds.
+	 * 
+	 * @return True, when the queue is constructed and it has the same size and item size.
+	 */
+	bool isCompatible() const {
+		return mReady.loadAcquire() && mMagic == magic && mCapacity == size && mItemSize == sizeof(T);
+	}
+
+	/*! \brief Push item to queue.
+	 * 
+	 * Thread and process safe push.
+	 * 
+	 * @param item The item to push to the queue.
+	 */
+	void push(const T &item){
+		boost::uint32_t mypos;
+		slot &myslot = this->claimPushSlot(mypos);
+		new (myslot.data.get()) T(item);
+		this->publishPushSlot(myslot, mypos);
+	}
+
+	/*! \brief Push item to queue, when it can be done without waiting.
+	 * 
+	 * Thread and process safe push, it can be mixed with push().
+	 * 
+	 * @param item The item to push to the queue.
+	 * @return True, when the item is pushed. False, when queue is full.
+	 */
+	bool tryPush(const T &item){
+		boost::uint32_t mypos;
+		slot *myslot = this->tryClaimPushSlot(mypos);
+		if(!myslot)
+			return false;
+		new (myslot->data.get()) T(item);
+		this->publishPushSlot(*myslot, mypos);
+		return true;
+	}
+
+	/*! \brief Reserve a slot for writing the item in place, in the shared memory.
+	 * 
+	 * Thread and process safe push in two steps, it waits for a free slot like push().
+	 * Write the item directly to the returned memory (e.g. decode or recv() into it), then call commitPush().
+	 * The popping threads will wait for this slot, so don't hold it for long.
+	 * 
+	 * @param position Set to the position of the reserved slot, pass it to commitPush(). It is the same in all processes.
+	 * @return Pointer to the storage of the slot, it is valid only in the calling process.
+	 */
+	T* reservePush(boost::uint32_t &position){
+		return this->claimPushSlot(position).data.get();
+	}
+
+	/*! \brief Publish the item written to the slot got from reservePush().
+	 * 
+	 * @param position The position from reservePush().
+	 */
+	void commitPush(boost::uint32_t position){
+		this->publishPushSlot(this->slotAt(position), position);
+	}
+
+	/*! \brief Pop item from queue.
+	 * 
+	 * Thread and process safe pop.
+	 * 
+	 * @param item Item, where the popped item will be copied.
+	 * @return True, when success. False, when queue is empty and signalNoMorePush() was called.
+	 */
+	bool pop(T &item){
+		boost::uint32_t mypos;
+		slot *myslot = this->claimPopSlot(mypos);
+		if(!myslot)
+			return false;
+		item = *myslot->data.get();
+		this->freePopSlot(*myslot, mypos);
+		return true;
+	}
+
+	/*! \brief Pop item from queue, when it can be done without waiting.
+	 * 
+	 * Thread and process safe pop, it can be mixed with pop().
+	 * 
+	 * @param item Item, where the popped item will be copied.
+	 * @return True, when success. False, when queue is empty.
+	 */
+	bool tryPop(T &item){
+		boost::uint32_t mypos;
+		slot *myslot = this->tryClaimPopSlot(mypos);
+		if(!myslot)
+			return false;
+		item = *myslot->data.get();
+		this->freePopSlot(*myslot, mypos);
+		return true;
+	}
+
+	/*! \brief Get the next item in place, in the shared memory, without copying it out.
+	 * 
+	 * Thread and process safe pop in two steps, it waits for data like pop().
+	 * The item stays in the slot, until releasePop() is called, the pushing threads will wait for this slot.
+	 * 
+	 * @param position Set to the position of the popped slot, pass it to releasePop().
+	 * @return Pointer to the item, it is valid only in the calling process. NULL, when queue is empty and signalNoMorePush() was called.
+	 */
+	const T* peekPop(boost::uint32_t &position){
+		slot *myslot = this->claimPopSlot(position);
+		if(!myslot)
+			return NULL;
+		return myslot->data.get();
+	}
+
+	/*! \brief Free the slot of the item got from peekPop().
+	 * 
+	 * @param position The position from peekPop().
+	 */
+	void releasePop(boost::uint32_t position){
+		this->freePopSlot(this->slotAt(position), position);
+	}
+
+	/*! \brief Close the queue for pushing.
+	 * 
+	 * The popping threads of all processes will return, when the queue is empty.
+	 * Items of pushes, which have taken their position before this call, are still popped.
+	 * 
+	 */
+	void signalNoMorePush(){
+		this->noMorePush().storeRelease(true);
+	}
+
+	/*! \brief Empty the queue and open it for pushing again.
+	 * 
+	 * Not thread or process safe, no other thread may use the queue meanwhile.
+	 * The positions are set back to zero and signalNoMorePush() is cleared.
+	 * 
+	 */
+	void reset(){
+		this->resetSlots();
+	}
+
+	/*! \brief Gets the estimated length of the queue
+	 * 
+	 * When pop threads are waiting for data, it will be negative.
+	 * When push threads are waiting in a full queue, it will be bigger then size.
+	 */
+	int getQueueLength(){
+		return (int)(this->writePos().loadRelaxed() - this->readPos().loadRelaxed());
+	}
+
+	/*! \brief Gets the number of slots in the queue.
+	 */
+	boost::uint32_t getCapacity() const {
+		return size;
+	}
+private:
+	interprocess_circular_queue(const interprocess_circular_queue&);
+	interprocess_circular_queue& operator=(const interprocess_circular_queue&);
+
+	static const boost::uint32_t magic = 0x43515350u; // "CQSP"
+
+	typedef typename circular_queue_detail::sequence_slots<T, size, padded_layout, Wait>::slot slot;
+
+	const boost::uint32_t mMagic; // checked by isCompatible()
+	const boost::uint32_t mCapacity; // size of the creator
+	const boost::uint32_t mItemSize; // sizeof(T) of the creator
+	circular_queue_detail::atomic<bool> mReady; // set at the end of the constructor
+};
+
+#endif //INTERPROCESS_CIRCULAR_QUEUE_H
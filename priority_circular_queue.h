@@ -0,0 +1,369 @@
+/**
+ * @file
+ * @author Peter Szucs <peter.szucs.dev@gmail.com>
+ *
+ * @section LICENSE
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @class priority_circular_queue
+ * \brief Multi-producer/multi-consumer queue with priority levels, made of one circular_queue per level.
+ * 
+ * Use this, when some items (e.g. control messages) shouldn't wait behind the bulk data.
+ * The fair threading of circular_queue is only kept within one level.
+ * A bitmask marks the non-empty levels, so the popping thread finds the next level with one bit scan.
+ * Two modes for popping:
+ * 	strict_priority: always pops from the lowest non-empty level, so level 0 is the most important.
+ * 		The higher levels can starve, while the lower ones are busy.
+ * 	weighted_round_robin: visits the non-empty levels round-robin, and pops maximum weight items from each, see setWeight().
+ *
+ * example: priority_circular_queue<message, 2> messages; messages.push(0, control); messages.push(1, data);
+ * 	then messages.pop(item) in the worker threads.
+ */
+
+#ifndef PRIORITY_CIRCULAR_QUEUE_H
+#define PRIORITY_CIRCULAR_QUEUE_H
+
+#include "circular_queue.h"
+#if defined(_MSC_VER)
+#include <intrin.h> //_BitScanForward()
+#endif
+
+namespace circular_queue_detail {
+	//index of the lowest set bit, mask can't be zero.
+	inline boost::uint32_t lowestBit(boost::uint32_t mask){
+		BOOST_ASSERT(mask != 0);
+	#if defined(__GNUC__)
+		return __builtin_ctz(mask);
+	#elif defined(_MSC_VER)
+		unsigned long index;
+		_BitScanForward(&index, mask);
+		return index;
+	#else
+		boost::uint32_t index = 0;
+		while(!(mask & 1u)){
+			mask >>= 1;
+			index++;
+		}
+		return index;
+	#endif
+	}
+}
+
+/*! \brief Pop order of priority_circular_queue.
+ */
+enum priority_mode {
+	strict_priority, //!< Pop from the lowest non-empty level.
+	weighted_round_robin //!< Pop from the non-empty levels round-robin, weight items from each.
+};
+
+/*! \brief The priority queue.
+ * 
+ * @tparam T Type of the items.
+ * @tparam levels Number of priority levels, maximum 32.
+ * @tparam size Number of slots in each level, needs to be power of two.
+ * @tparam Layout Slot layout of the levels: packed_layout or padded_layout.
+ * @tparam Wait Wait strategy: default_wait, spin_wait, spin_yield_wait, backoff_wait, spin_sleep_wait or park_wait.
+ */
+template <typename T, boost::uint32_t levels, boost::uint32_t size = 32u, typename Layout = packed_layout, typename Wait = default_wait>
+class priority_circular_queue {
+public:
+	/*! \brief Creates the queue.
+	 * 
+	 * @param mode Pop order, the weights are 1 by default.
+	 */
+	explicit priority_circular_queue(priority_mode mode = strict_priority) :
+		mMode(mode)
+	{
+		//one bit for every level in the mask.
+		BOOST_STATIC_ASSERT( levels != 0 && levels <= 32 );
+		for(boost::uint32_t i = 0; i < levels; i++){
+			mWeights[i] = 1;
+		}
+		//the first pop starts with level 0.
+		mTurn.storeRelaxed(levels - 1);
+	}
+
+	/*! \brief Sets the number of items popped from the level in one round, in weighted_round_robin mode.
+	 * 
+	 * Not thread-safe, set the weights before using the queue.
+	 * 
+	 * @param level Priority level.
+	 * @param weight Number of items, between 1 and 2^24-1.
+	 */
+	void setWeight(boost::uint32_t level, boost::uint32_t weight){
+		BOOST_ASSERT(level < levels);
+		BOOST_ASSERT(weight != 0 && weight < (1u << 24));
+		mWeights[level] = weight;
+	}
+
+	/*! \brief Push item to the level.
+	 * 
+	 * Thread-safe push.
+	 * Waits, when the level is full.
+	 * 
+	 * @param level Priority level, 0 is the highest in strict_priority mode.
+	 * @param item The item to push to the queue.
+	 */
+	void push(boost::uint32_t level, const T &item){
+		BOOST_ASSERT(level < levels);
+		mLanes[level].push(item);
+		markLevel(level);
+	}
+#ifndef BOOST_NO_CXX11_RVALUE_REFERENCES
+	/*! \brief Push item to the level.
+	 * 
+	 * Same as push(boost::uint32_t, const T&), but the item is moved into the queue.
+	 * 
+	 * @param level Priority level, 0 is the highest in strict_priority mode.
+	 * @param item The item to push to the queue.
+	 */
+	void push(boost::uint32_t level, T &&item){
+		BOOST_ASSERT(level < levels);
+		mLanes[level].push(std::move(item));
+		markLevel(level);
+	}
+#endif
+
+	/*! \brief Push item to the level, when it is not full.
+	 * 
+	 * Thread-safe push, it can be mixed with push().
+	 * 
+	 * @param level Priority level, 0 is the highest in strict_priority mode.
+	 * @param item The item to push to the queue.
+	 * @return True, when the item is pushed. False, when the level is full.
+	 */
+	bool tryPush(boost::uint32_t level, const T &item){
+		BOOST_ASSERT(level < levels);
+		if(!mLanes[level].tryPush(item))
+			return false;
+		markLevel(level);
+		return true;
+	}
+
+	/*! \brief Pop item from the next level, by the mode.
+	 * 
+	 * Thread-safe pop.
+	 * 
+	 * @param item Item, where the popped item will be moved.
+	 * @param level Set to the level of the popped item.
+	 * @return True, when success. False, when all levels are empty and signalNoMorePush() was called.
+	 */
+	bool pop(T &item, boost::uint32_t &level){
+		Wait waiter(mParking);
+		for(;;){
+			if(tryPop(item, level))
+				return true;
+			if(isDrained())
+				return false;
+			waiter.wait();
+		}
+	}
+
+	/*! \brief Pop item from the next level, by the mode.
+	 * 
+	 * Same as pop(T&, boost::uint32_t&), without the level.
+	 */
+	bool pop(T &item){
+		boost::uint32_t level;
+		return pop(item, level);
+	}
+
+	/*! \brief Pop item from the next level, when it can be done without waiting.
+	 * 
+	 * Thread-safe pop, it can be mixed with pop().
+	 * 
+	 * @param item Item, where the popped item will be moved.
+	 * @param level Set to the level of the popped item.
+	 * @return True, when success. False, when all levels are empty.
+	 */
+	bool tryPop(T &item, boost::uint32_t &level){
+		for(;;){
+			boost::uint32_t mask = mMask.loadAcquire();
+			if(mask == 0)
+				return false;
+			level = nextLevel(mask);
+			if(mLanes[level].tryPop(item)){
+				chargeLevel(level);
+				return true;
+			}
+			unmarkLevel(level);
+		}
+	}
+
+	/*! \brief Pop item from the next level, when it can be done without waiting.
+	 * 
+	 * Same as tryPop(T&, boost::uint32_t&), without the level.
+	 */
+	bool tryPop(T &item){
+		boost::uint32_t level;
+		return tryPop(item, level);
+	}
+
+	/*! \brief Close the queue for pushing.
+	 * 
+	 * Call it, when all producers are done, the popping threads will return, when all levels are empty.
+	 * 
+	 */
+	void signalNoMorePush(){
+		mNoMorePush.storeRelease(true);
+		mParking.notify();
+	}
+
+	/*! \brief Empty the queue and open it for pushing again.
+	 * 
+	 * Not thread-safe, no other thread may use the queue meanwhile.
+	 * The items of all levels are destroyed and signalNoMorePush() is cleared, the weights are kept.
+	 * 
+	 */
+	void reset(){
+		for(boost::uint32_t i = 0; i < levels; i++){
+			mLanes[i].reset();
+		}
+		mMask.storeRelaxed(0);
+		mTurn.storeRelaxed(levels - 1);
+		mNoMorePush.storeRelease(false);
+	}
+
+	/*! \brief Gets the number of items in all levels.
+	 * 
+	 * It is only an estimate, while the queue is used.
+	 */
+	int getQueueLength(){
+		int length = 0;
+		for(boost::uint32_t i = 0; i < levels; i++){
+			length += mLanes[i].getQueueLength();
+		}
+		return length;
+	}
+
+	/*! \brief Gets the number of items in the level.
+	 * 
+	 * @param level Priority level.
+	 */
+	int getQueueLength(boost::uint32_t level){
+		BOOST_ASSERT(level < levels);
+		return mLanes[level].getQueueLength();
+	}
+
+	/*! \brief Gets the number of items in all levels, approximately.
+	 * 
+	 * Every level is counted between 0 and size, so it is never negative.
+	 */
+	boost::uint32_t getSizeApprox(){
+		boost::uint32_t length = 0;
+		for(boost::uint32_t i = 0; i < levels; i++){
+			length += mLanes[i].getSizeApprox();
+		}
+		return length;
+	}
+
+	/*! \brief Checks, if all levels are empty.
+	 */
+	bool isEmpty(){
+		for(boost::uint32_t i = 0; i < levels; i++){
+			if(!mLanes[i].isEmpty())
+				return false;
+		}
+		return true;
+	}
+
+	/*! \brief Checks, if the next push to the level would wait for a free slot.
+	 * 
+	 * @param level Priority level.
+	 */
+	bool isFull(boost::uint32_t level){
+		BOOST_ASSERT(level < levels);
+		return mLanes[level].isFull();
+	}
+private:
+	priority_circular_queue(const priority_circular_queue&);
+	priority_circular_queue& operator=(const priority_circular_queue&);
+
+	typedef circular_queue<T, size, Layout, Wait> lane;
+
+	//called after the push, so the popping threads will find the item.
+	//The bit is mostly set already, then it is only a load, so the pushes don't write the shared mask.
+	//The fences pair with unmarkLevel(): either we see the cleared bit, or it sees the item.
+	void markLevel(boost::uint32_t level){
+		boost::uint32_t bit = 1u << level;
+		circular_queue_detail::fenceSeqCst();
+		boost::uint32_t mask = mMask.loadRelaxed();
+		while(!(mask & bit) && !mMask.compareExchange(mask, mask | bit)) { }
+		mParking.notify();
+	}
+
+	//true, when signalNoMorePush() was called and no level has a taken position.
+	//items of pushes, which have taken their position before signalNoMorePush(), are still waited for.
+	bool isDrained(){
+		if(!mNoMorePush.loadAcquire())
+			return false;
+		for(boost::uint32_t i = 0; i < levels; i++){
+			if(mLanes[i].getQueueLength() > 0)
+				return false;
+		}
+		return true;
+	}
+
+	void unmarkLevel(boost::uint32_t level){
+		boost::uint32_t bit = 1u << level;
+		boost::uint32_t mask = mMask.loadRelaxed();
+		while((mask & bit) && !mMask.compareExchange(mask, mask & ~bit)) { }
+		//a push may have finished before the bit was cleared, and it has seen the bit still set.
+		circular_queue_detail::fenceSeqCst();
+		if(!mLanes[level].isEmpty()){
+			mask = mMask.loadRelaxed();
+			while(!(mask & bit) && !mMask.compareExchange(mask, mask | bit)) { }
+		}
+	}
+
+	boost::uint32_t nextLevel(boost::uint32_t mask){
+		if(mMode == strict_priority)
+			return circular_queue_detail::lowestBit(mask);
+		//the turn is the current level in the low 8 bits, and the items left from its weight above.
+		//It is only a hint, a lost update between popping threads changes the share a bit.
+		boost::uint32_t turn = mTurn.loadRelaxed();
+		boost::uint32_t level = turn & 0xffu;
+		if((turn >> 8) != 0 && (mask & (1u << level)))
+			return level;
+		//next non-empty level after the current one, or the first one.
+		boost::uint32_t after = mask & ~((2u << level) - 1u);
+		level = circular_queue_detail::lowestBit(after != 0 ? after : mask);
+		mTurn.storeRelaxed(level | (mWeights[level] << 8));
+		return level;
+	}
+
+	void chargeLevel(boost::uint32_t level){
+		if(mMode == strict_priority)
+			return;
+		boost::uint32_t turn = mTurn.loadRelaxed();
+		if((turn & 0xffu) == level && (turn >> 8) != 0)
+			mTurn.storeRelaxed(turn - (1u << 8));
+	}
+
+	lane mLanes[levels];
+	const priority_mode mMode;
+	boost::uint32_t mWeights[levels];
+	circular_queue_detail::atomic<boost::uint32_t> mMask; // bit for every level, which may have data
+	circular_queue_detail::atomic<boost::uint32_t> mTurn; // weighted_round_robin state, see nextLevel()
+	circular_queue_detail::atomic<bool> mNoMorePush;
+	typename Wait::parking mParking; //wakes up the popping threads for park_wait
+};
+
+#endif //PRIORITY_CIRCULAR_QUEUE_H
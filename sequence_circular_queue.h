@@ -0,0 +1,614 @@
+/**
+ * @file
+ * @author Peter Szucs <peter.szucs.dev@gmail.com>
+ *
+ * @section LICENSE
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @class sequence_circular_queue
+ * \brief Multi-producer/multi-consumer circular queue with one sequence number per slot.
+ * 
+ * Same usage as circular_queue, but every slot has a single sequence counter instead of the
+ * mHasData flag and the push/pop ticket pair. The sequence tells whose turn it is and
+ * whether the slot is full or empty:<ul>
+ * 	<li>sequence == pos: slot is empty, the pusher of pos can write it</li>
+ * 	<li>sequence == pos + 1: slot is full, the popper of pos can read it</li>
+ * 	<li>popper sets sequence to pos + size, which is the next pusher's position on that slot</li>
+ * </ul>
+ * So push and pop are a single fetchAdd on the position and a load/store on the slot,
+ * which is half the atomic operations of circular_queue::push() and circular_queue::pop().
+ * Threads are served in the order of their positions, so it is fair too.
+ *
+ * example: see circular_queue_example.cpp, it works the same with sequence_circular_queue.
+ */
+
+#ifndef SEQUENCE_CIRCULAR_QUEUE_H
+#define SEQUENCE_CIRCULAR_QUEUE_H
+
+#include "circular_queue.h"
+
+namespace circular_queue_detail {
+	/* The slot protocol of sequence_circular_queue, it is shared with interprocess_circular_queue.
+	 * All state is inside the object, so it works in shared memory too. Layout is packed_layout or padded_layout.
+	 * Pushing and popping is done in 3 steps:
+	 * 	1. claim: get a position and wait until the slot is ready for it
+	 * 	2. construct the item in the slot, or move it out and destroy it
+	 * 	3. publish/free: give the slot to the other side
+	 */
+	template <typename T, boost::uint32_t size, typename Layout, typename Wait>
+	class sequence_slots {
+	protected:
+		struct slot {
+			atomic<boost::uint32_t> sequence; // see sequence_circular_queue
+			slot_storage<T> data;
+		};
+
+		sequence_slots(){
+			// 0x100000000 needs to be dividable by size or it will fail on overflow.
+			BOOST_STATIC_ASSERT( (0xFFFFFFFFu % size) == (size - 1) );
+			// with 1 slot, full and popped sequence would be the same.
+			BOOST_STATIC_ASSERT( size >= 2 );
+
+			for(boost::uint32_t i = 0; i < size; i++){
+				mSlots[i].value.sequence.storeRelaxed(i);
+			}
+		}
+		~sequence_slots(){
+			destroyItems();
+		}
+
+		slot& slotAt(boost::uint32_t pos){ return mSlots[pos % size].value; }
+		atomic<boost::uint32_t>& writePos(){ return mWritePos.value; }
+		atomic<boost::uint32_t>& readPos(){ return mReadPos.value; }
+		atomic<bool>& noMorePush(){ return mNoMorePush; }
+		typename Wait::parking& parking(){ return mParking; }
+
+		slot& claimPushSlot(boost::uint32_t &mypos){
+			BOOST_ASSERT(!mNoMorePush.loadRelaxed());
+			mypos = mWritePos.value.fetchAdd(1);
+			Wait waiter(mParking);
+			return waitPushSlot(mypos, waiter);
+		}
+		slot& waitPushSlot(boost::uint32_t mypos, Wait &waiter){
+			slot &myslot = slotAt(mypos);
+
+			//queue is full, or a previous lap is still pushing/popping this slot.
+			while(myslot.sequence.loadAcquire() != mypos){
+				waiter.wait();
+			}
+			return myslot;
+		}
+		slot* tryClaimPushSlot(boost::uint32_t &mypos){
+			BOOST_ASSERT(!mNoMorePush.loadRelaxed());
+			mypos = mWritePos.value.loadRelaxed();
+			for(;;){
+				slot &myslot = slotAt(mypos);
+				boost::int32_t diff = (boost::int32_t)(myslot.sequence.loadAcquire() - mypos);
+				if(diff == 0){
+					if(mWritePos.value.compareExchange(mypos, mypos + 1))
+						return &myslot;
+				} else if(diff < 0){
+					//slot has data from the previous round.
+					return NULL;
+				} else {
+					//other thread has taken mypos.
+					mypos = mWritePos.value.loadRelaxed();
+				}
+			}
+		}
+		void publishPushSlot(slot &myslot, boost::uint32_t mypos){
+			myslot.sequence.storeRelease(mypos + 1);
+			mParking.notify();
+		}
+		slot* claimPopSlot(boost::uint32_t &mypos){
+			mypos = mReadPos.value.fetchAdd(1);
+			slot &myslot = slotAt(mypos);
+
+			Wait waiter(mParking);
+			//queue is empty, wait for data.
+			while(myslot.sequence.loadAcquire() != mypos + 1){
+				if(isDrainedAt(mypos))
+					return NULL;
+				waiter.wait();
+			}
+			return &myslot;
+		}
+		slot* tryClaimPopSlot(boost::uint32_t &mypos){
+			mypos = mReadPos.value.loadRelaxed();
+			for(;;){
+				slot &myslot = slotAt(mypos);
+				boost::int32_t diff = (boost::int32_t)(myslot.sequence.loadAcquire() - (mypos + 1));
+				if(diff == 0){
+					if(mReadPos.value.compareExchange(mypos, mypos + 1))
+						return &myslot;
+				} else if(diff < 0){
+					//data is not pushed yet.
+					return NULL;
+				} else {
+					//other thread has taken mypos.
+					mypos = mReadPos.value.loadRelaxed();
+				}
+			}
+		}
+		//the item needs to be moved or copied out before.
+		void freePopSlot(slot &myslot, boost::uint32_t mypos){
+			myslot.data.get()->~T();
+			myslot.sequence.storeRelease(mypos + size);
+			mParking.notify();
+		}
+		//true, when signalNoMorePush() was called and no push has taken mypos, so data will never come for it.
+		bool isDrainedAt(boost::uint32_t mypos){
+			if(!mNoMorePush.loadAcquire())
+				return false;
+			return (boost::int32_t)(mWritePos.value.loadRelaxed() - mypos) <= 0;
+		}
+		//true, when the item of mypos is pushed, or it is popped already.
+		bool isPushedAt(boost::uint32_t mypos){
+			return (boost::int32_t)(slotAt(mypos).sequence.loadAcquire() - (mypos + 1)) >= 0;
+		}
+		//true, when the slot of mypos has data from the previous round.
+		bool isTakenAt(boost::uint32_t mypos){
+			return (boost::int32_t)(slotAt(mypos).sequence.loadAcquire() - mypos) < 0;
+		}
+		//the pushed items at the ends, the pushes in progress are not counted.
+		boost::uint32_t sizeApprox(){
+			boost::uint32_t readPos = mReadPos.value.loadRelaxed();
+			boost::int32_t length = (boost::int32_t)(mWritePos.value.loadRelaxed() - readPos);
+			if(length <= 0 || !isPushedAt(readPos))
+				return 0;
+			if(length > (boost::int32_t)size)
+				length = size;
+			//it only walks over the pushes in progress.
+			while(length > 1 && !isPushedAt(readPos + length - 1))
+				length--;
+			return (boost::uint32_t)length;
+		}
+		//not thread-safe, the items are destroyed, the positions are set back to zero and signalNoMorePush() is cleared.
+		void resetSlots(){
+			destroyItems();
+			for(boost::uint32_t i = 0; i < size; i++){
+				mSlots[i].value.sequence.storeRelaxed(i);
+			}
+			mWritePos.value.storeRelaxed(0);
+			mReadPos.value.storeRelaxed(0);
+			mNoMorePush.storeRelease(false);
+		}
+	private:
+		sequence_slots(const sequence_slots&);
+		sequence_slots& operator=(const sequence_slots&);
+
+		void destroyItems(){
+			for(boost::uint32_t i = 0; i < size; i++){
+				slot &myslot = mSlots[i].value;
+				//slot has data, when sequence is position + 1.
+				if((myslot.sequence.loadRelaxed() - i) % size == 1)
+					myslot.data.get()->~T();
+			}
+		}
+
+		layout_cell<slot, Layout> mSlots[size];
+		layout_cell<atomic<boost::uint32_t>, Layout> mWritePos; // push position
+		layout_cell<atomic<boost::uint32_t>, Layout> mReadPos; // pop position
+		atomic<bool> mNoMorePush;
+		typename Wait::parking mParking; //wakes up sleeping threads for park_wait
+	};
+}
+
+/*! \brief The sequence based circular queue.
+ * 
+ * Items are constructed in the slot at push, and destroyed in the slot at pop,
+ * so T doesn't need default constructor.
+ * 
+ * @tparam T Type of the items.
+ * @tparam size Number of slots, needs to be power of two and at least 2.
+ * @tparam Layout Memory layout of the slots: packed_layout or padded_layout.
+ * @tparam Wait Wait strategy: default_wait, spin_wait, spin_yield_wait, backoff_wait, spin_sleep_wait or park_wait.
+ */
+template <typename T, boost::uint32_t size = 32u, typename Layout = packed_layout, typename Wait = default_wait>
+class sequence_circular_queue : private circular_queue_detail::sequence_slots<T, size, Layout, Wait> {
+public:
+	typedef T value_type; //!< type of the items, used by batching_producer
+
+	sequence_circular_queue() { }
+
+	/*! \brief Push item to queue.
+	 * 
+	 * Thread-safe push.
+	 * 
+	 * @param item The item to push to the queue.
+	 */
+	void push(const T &item){
+		boost::uint32_t mypos;
+		slot &myslot = this->claimPushSlot(mypos);
+		new (myslot.data.get()) T(item);
+		this->publishPushSlot(myslot, mypos);
+	}
+#ifndef BOOST_NO_CXX11_RVALUE_REFERENCES
+	/*! \brief Push item to queue.
+	 * 
+	 * Thread-safe push, the item is moved into the queue.
+	 * 
+	 * @param item The item to push to the queue.
+	 */
+	void push(T &&item){
+		boost::uint32_t mypos;
+		slot &myslot = this->claimPushSlot(mypos);
+		new (myslot.data.get()) T(std::move(item));
+		this->publishPushSlot(myslot, mypos);
+	}
+#endif
+#if !defined(BOOST_NO_CXX11_RVALUE_REFERENCES) && !defined(BOOST_NO_CXX11_VARIADIC_TEMPLATES)
+	/*! \brief Construct item in the queue.
+	 * 
+	 * Thread-safe push, the item is constructed directly in the slot of the queue.
+	 * 
+	 * @param args Arguments for the constructor of T.
+	 */
+	template <class... Args>
+	void emplace(Args&&... args){
+		boost::uint32_t mypos;
+		slot &myslot = this->claimPushSlot(mypos);
+		new (myslot.data.get()) T(std::forward<Args>(args)...);
+		this->publishPushSlot(myslot, mypos);
+	}
+#endif
+
+	/*! \brief Push item to queue, when it can be done without waiting.
+	 * 
+	 * Thread-safe push, it can be mixed with push().
+	 * The position is only taken, when the slot is free.
+	 * 
+	 * @param item The item to push to the queue.
+	 * @return True, when the item is pushed. False, when queue is full.
+	 */
+	bool tryPush(const T &item){
+		boost::uint32_t mypos;
+		slot *myslot = this->tryClaimPushSlot(mypos);
+		if(!myslot)
+			return false;
+		new (myslot->data.get()) T(item);
+		this->publishPushSlot(*myslot, mypos);
+		return true;
+	}
+#ifndef BOOST_NO_CXX11_RVALUE_REFERENCES
+	/*! \brief Push item to queue, when it can be done without waiting.
+	 * 
+	 * Same as tryPush(const T&), but the item is moved into the queue.
+	 * The item is only moved, when it is pushed.
+	 * 
+	 * @param item The item to push to the queue.
+	 * @return True, when the item is pushed. False, when queue is full.
+	 */
+	bool tryPush(T &&item){
+		boost::uint32_t mypos;
+		slot *myslot = this->tryClaimPushSlot(mypos);
+		if(!myslot)
+			return false;
+		new (myslot->data.get()) T(std::move(item));
+		this->publishPushSlot(*myslot, mypos);
+		return true;
+	}
+#endif
+#if !defined(BOOST_NO_CXX11_RVALUE_REFERENCES) && !defined(BOOST_NO_CXX11_VARIADIC_TEMPLATES)
+	/*! \brief Construct item in the queue, when it can be done without waiting.
+	 * 
+	 * Same as emplace(), but returns false, when queue is full.
+	 * 
+	 * @param args Arguments for the constructor of T.
+	 * @return True, when the item is pushed. False, when queue is full.
+	 */
+	template <class... Args>
+	bool tryEmplace(Args&&... args){
+		boost::uint32_t mypos;
+		slot *myslot = this->tryClaimPushSlot(mypos);
+		if(!myslot)
+			return false;
+		new (myslot->data.get()) T(std::forward<Args>(args)...);
+		this->publishPushSlot(*myslot, mypos);
+		return true;
+	}
+#endif
+
+	/*! \brief Push items to queue.
+	 * 
+	 * Thread-safe push, the positions for all items are taken with a single atomic operation,
+	 * so the items will be next to each other in the queue.
+	 * 
+	 * @param items The items to push to the queue.
+	 * @param count Number of items.
+	 */
+	void push(const T *items, std::size_t count){
+		push(items, items + count);
+	}
+
+	/*! \brief Push items to queue.
+	 * 
+	 * Thread-safe push, the positions for all items are taken with a single atomic operation,
+	 * so the items will be next to each other in the queue.
+	 * 
+	 * @param first Iterator to the first item to push.
+	 * @param last Iterator after the last item to push.
+	 */
+	template <class ForwardIt>
+	void push(ForwardIt first, ForwardIt last){
+		BOOST_ASSERT(!this->noMorePush().loadRelaxed());
+		boost::uint32_t mypos = this->writePos().fetchAdd((boost::uint32_t)std::distance(first, last));
+
+		Wait waiter(this->parking());
+		for(; first != last; ++first, ++mypos){
+			slot &myslot = this->waitPushSlot(mypos, waiter);
+			new (myslot.data.get()) T(*first);
+			//the workers can start with the first items, while we wait for the rest.
+			this->publishPushSlot(myslot, mypos);
+		}
+	}
+
+	/*! \brief Push item to queue, wait until there is a free slot or the timeout expires.
+	 * 
+	 * Thread-safe push, it can be mixed with push().
+	 * Waiting is done with tryPush(), so there is no fair threading between the waiting threads.
+	 * 
+	 * @param item The item to push to the queue.
+	 * @param relTime Maximum time to wait.
+	 * @return True, when the item is pushed. False, when the timeout expired.
+	 */
+	template <class Rep, class Period>
+	bool pushFor(const T &item, const boost::chrono::duration<Rep, Period> &relTime){
+		return pushUntil(item, circular_queue_detail::timeout_clock::now() + relTime);
+	}
+
+	/*! \brief Push item to queue, wait until there is a free slot or the deadline.
+	 * 
+	 * Thread-safe push, it can be mixed with push().
+	 * Waiting is done with tryPush(), so there is no fair threading between the waiting threads.
+	 * 
+	 * @param item The item to push to the queue.
+	 * @param absTime Deadline.
+	 * @return True, when the item is pushed. False, when the deadline is reached.
+	 */
+	template <class Clock, class Duration>
+	bool pushUntil(const T &item, const boost::chrono::time_point<Clock, Duration> &absTime){
+		Wait waiter(this->parking());
+		while(!tryPush(item)){
+			if(Clock::now() >= absTime)
+				return false;
+			waiter.wait();
+		}
+		return true;
+	}
+
+	/*! \brief Pop item from queue and return the popped item.
+	 * 
+	 * Thread-safe pop.
+	 * 
+	 * @param item Item, where the popped item will be moved.
+	 * @return True, when success. False, when queue is empty and signalNoMorePush() was called.
+	 */
+	bool pop(T &item){
+		boost::uint32_t mypos;
+		slot *myslot = this->claimPopSlot(mypos);
+		if(!myslot)
+			return false;
+		item = boost::move(*myslot->data.get());
+		this->freePopSlot(*myslot, mypos);
+		return true;
+	}
+
+	/*! \brief Pop item from queue, when it can be done without waiting.
+	 * 
+	 * Thread-safe pop, it can be mixed with pop().
+	 * The position is only taken, when the slot has data.
+	 * 
+	 * @param item Item, where the popped item will be moved.
+	 * @return True, when success. False, when queue is empty.
+	 */
+	bool tryPop(T &item){
+		boost::uint32_t mypos;
+		slot *myslot = this->tryClaimPopSlot(mypos);
+		if(!myslot)
+			return false;
+		item = boost::move(*myslot->data.get());
+		this->freePopSlot(*myslot, mypos);
+		return true;
+	}
+
+	/*! \brief Pop items from queue.
+	 * 
+	 * Thread-safe pop, it can be mixed with pop().
+	 * It waits for data, and pops the items availible (maximum count), the positions are taken with a single atomic operation.
+	 * 
+	 * @param out Output iterator, where the popped items will be moved.
+	 * @param count Maximum number of items to pop.
+	 * @return Number of popped items. Zero, when count is zero, or queue is empty and signalNoMorePush() was called.
+	 */
+	template <class OutputIt>
+	std::size_t pop(OutputIt out, std::size_t count){
+		//nothing would be ready, it would wait forever.
+		if(count == 0)
+			return 0;
+		Wait waiter(this->parking());
+		bool drained = false;
+		boost::uint32_t mypos = this->readPos().loadRelaxed();
+		boost::uint32_t ready;
+		for(;;){
+			ready = 0;
+			while(ready < count && ready < size
+				&& this->slotAt(mypos + ready).sequence.loadAcquire() == mypos + ready + 1)
+				ready++;
+
+			if(ready != 0){
+				if(this->readPos().compareExchange(mypos, mypos + ready))
+					break;
+			} else if(drained){
+				//queue was empty after signalNoMorePush(), and all taken pushes are popped.
+				return 0;
+			} else {
+				drained = this->isDrainedAt(mypos);
+				if(!drained)
+					waiter.wait();
+				mypos = this->readPos().loadRelaxed();
+			}
+		}
+
+		for(boost::uint32_t i = 0; i < ready; i++, mypos++, ++out){
+			slot &myslot = this->slotAt(mypos);
+			*out = boost::move(*myslot.data.get());
+			myslot.data.get()->~T();
+			myslot.sequence.storeRelease(mypos + size);
+		}
+		this->parking().notify();
+		return ready;
+	}
+
+	/*! \brief Pop item from queue, wait until there is data or the timeout expires.
+	 * 
+	 * Thread-safe pop, it can be mixed with pop().
+	 * Waiting is done with tryPop(), so there is no fair threading between the waiting threads.
+	 * 
+	 * @param item Item, where the popped item will be moved.
+	 * @param relTime Maximum time to wait.
+	 * @return True, when success. False, when the timeout expired or queue is empty and signalNoMorePush() was called.
+	 */
+	template <class Rep, class Period>
+	bool popFor(T &item, const boost::chrono::duration<Rep, Period> &relTime){
+		return popUntil(item, circular_queue_detail::timeout_clock::now() + relTime);
+	}
+
+	/*! \brief Pop item from queue, wait until there is data or the deadline.
+	 * 
+	 * Thread-safe pop, it can be mixed with pop().
+	 * Waiting is done with tryPop(), so there is no fair threading between the waiting threads.
+	 * 
+	 * @param item Item, where the popped item will be moved.
+	 * @param absTime Deadline.
+	 * @return True, when success. False, when the deadline is reached or queue is empty and signalNoMorePush() was called.
+	 */
+	template <class Clock, class Duration>
+	bool popUntil(T &item, const boost::chrono::time_point<Clock, Duration> &absTime){
+		Wait waiter(this->parking());
+		while(!tryPop(item)){
+			//items pushed before signalNoMorePush() are still popped, even when the push is not finished yet.
+			if(this->isDrainedAt(this->readPos().loadRelaxed()))
+				return tryPop(item);
+			if(Clock::now() >= absTime)
+				return false;
+			waiter.wait();
+		}
+		return true;
+	}
+
+	/*! \brief Pop item from queue and return the popped item.
+	 * 
+	 * Thread-safe pop.
+	 * Will throw exNoMorePush exception, when queue is empty and signalNoMorePush() was called.
+	 * The returned item is move constructed from the slot.
+	 * 
+	 * @return The item popped.
+	 */
+	T pop(){
+		boost::uint32_t mypos;
+		slot *myslot = this->claimPopSlot(mypos);
+		if(!myslot)
+			throw exNoMorePush();
+		T data(boost::move(*myslot->data.get()));
+		this->freePopSlot(*myslot, mypos);
+		return data;
+	}
+
+	/*! \brief Close the queue for pushing.
+	 * 
+	 * When you don't want to push any more data, you can call this, and all threads waiting for data will return.
+	 * Pushes, which have taken their position before this call, are still popped, so no item is lost.
+	 * 
+	 */
+	void signalNoMorePush(){
+		this->noMorePush().storeRelease(true);
+		this->parking().notify();
+	}
+
+	/*! \brief Checks, if signalNoMorePush() was called and all pushed items are popped.
+	 */
+	bool isDrained(){
+		return this->isDrainedAt(this->readPos().loadRelaxed());
+	}
+
+	/*! \brief Gets the parking of the queue, it is notified after every push and pop.
+	 * 
+	 * Used by circular_queue_set, to wake up a thread waiting on more queues.
+	 */
+	typename Wait::parking& getParking(){
+		return this->parking();
+	}
+
+	/*! \brief Empty the queue and open it for pushing again.
+	 * 
+	 * Not thread-safe, no other thread may use the queue meanwhile.
+	 * The remaining items are destroyed, the positions are set back to zero and signalNoMorePush() is cleared.
+	 * 
+	 */
+	void reset(){
+		this->resetSlots();
+	}
+
+	/*! \brief Gets the estimated length of the queue
+	 * 
+	 * When pop threads are waiting for data, it will be negative.
+	 * When push threads are waiting in a full queue, it will be bigger then size. 
+	 */
+	int getQueueLength(){
+		return (int)(this->writePos().loadRelaxed() - this->readPos().loadRelaxed());
+	}
+
+	/*! \brief Gets the number of pushed items in the queue, approximately.
+	 * 
+	 * Unlike getQueueLength(), it is never negative and never bigger than size.
+	 * It is 0, when the slot at the read position is not pushed yet (same as isEmpty()),
+	 * and the pushes at the write position, which are in progress, are not counted.
+	 */
+	boost::uint32_t getSizeApprox(){
+		return this->sizeApprox();
+	}
+
+	/*! \brief Checks, if the next item to pop is pushed already.
+	 * 
+	 * Only the slot at the read position is checked.
+	 */
+	bool isEmpty(){
+		return !this->isPushedAt(this->readPos().loadRelaxed());
+	}
+
+	/*! \brief Checks, if the next push would wait for a free slot.
+	 * 
+	 * Only the slot at the write position is checked.
+	 */
+	bool isFull(){
+		return this->isTakenAt(this->writePos().loadRelaxed());
+	}
+
+	/*! \brief Gets the number of slots in the queue.
+	 */
+	boost::uint32_t getCapacity() const {
+		return size;
+	}
+private:
+	typedef typename circular_queue_detail::sequence_slots<T, size, Layout, Wait>::slot slot;
+};
+
+#endif //SEQUENCE_CIRCULAR_QUEUE_H
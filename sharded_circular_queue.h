@@ -0,0 +1,378 @@
+/**
+ * @file
+ * @author Peter Szucs <peter.szucs.dev@gmail.com>
+ *
+ * @section LICENSE
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @class sharded_circular_queue
+ * \brief Multi-producer/single-consumer queue made of one spsc_circular_queue per producer.
+ * 
+ * Use this for collecting data (logs, metrics) from many threads into one thread.
+ * Every producer thread gets its own shard, so pushing threads don't share any position or slot,
+ * there is no contention between them. The popping thread drains the shards round-robin,
+ * with pop(out, count) it takes a batch from every shard.
+ * The order of items is only kept between the items of the same producer.
+ * Every shard is allocated separately, so it can be placed on the NUMA node of its producer.
+ * With park_wait, a producer wakes up the popping thread only, when its shard was empty.
+ *
+ * example: see circular_queue_example.cpp, with 1 popping thread and tasks.push(producer, item) in the pushing threads.
+ */
+
+#ifndef SHARDED_CIRCULAR_QUEUE_H
+#define SHARDED_CIRCULAR_QUEUE_H
+
+#include "spsc_circular_queue.h"
+#include <boost/type_traits/is_same.hpp>
+
+/*! \brief The sharded multi-producer/single-consumer queue.
+ * 
+ * @tparam T Type of the items.
+ * @tparam size Number of slots in each shard, needs to be power of two.
+ * @tparam Wait Wait strategy: default_wait, spin_wait, spin_yield_wait, backoff_wait, spin_sleep_wait or park_wait.
+ */
+template <typename T, boost::uint32_t size = 32u, typename Wait = default_wait>
+class sharded_circular_queue {
+public:
+	/*! \brief Creates the queue.
+	 * 
+	 * @param producers Number of shards, one for each pushing thread.
+	 */
+	explicit sharded_circular_queue(boost::uint32_t producers) :
+		mCount(producers),
+		mNext(0)
+	{
+		createShards(NULL);
+	}
+
+	/*! \brief Creates the queue, with the shards on NUMA nodes.
+	 * 
+	 * @param producers Number of shards, one for each pushing thread.
+	 * @param placements Placement of each shard, e.g. the node of the CPU, where the producer is pinned.
+	 */
+	sharded_circular_queue(boost::uint32_t producers, const memory_placement *placements) :
+		mCount(producers),
+		mNext(0)
+	{
+		createShards(placements);
+	}
+
+	/*! \brief Gets a free shard for the calling thread.
+	 * 
+	 * Every pushing thread should call it once, and use the returned value in push().
+	 * You can also use your own thread numbering, from 0 to producers-1.
+	 * 
+	 * @return The producer index.
+	 */
+	boost::uint32_t addProducer(){
+		boost::uint32_t producer = mProducers.fetchAdd(1);
+		BOOST_ASSERT(producer < mCount);
+		return producer;
+	}
+
+	/*! \brief Push item to the shard of the producer.
+	 * 
+	 * Only one thread may push with the same producer index.
+	 * Waits, when the shard is full.
+	 * 
+	 * @param producer Producer index from addProducer().
+	 * @param item The item to push to the queue.
+	 */
+	void push(boost::uint32_t producer, const T &item){
+		BOOST_ASSERT(producer < mCount);
+		shard &current = mShards[producer];
+		if(!current.tryPush(item)){
+			Wait waiter(mParking);
+			//the shard is full, wait for the popping thread.
+			while(!current.tryPush(item))
+				waiter.wait();
+		}
+		notifyPushed(current);
+	}
+#ifndef BOOST_NO_CXX11_RVALUE_REFERENCES
+	/*! \brief Push item to the shard of the producer.
+	 * 
+	 * Same as push(boost::uint32_t, const T&), but the item is moved into the queue.
+	 * 
+	 * @param producer Producer index from addProducer().
+	 * @param item The item to push to the queue.
+	 */
+	void push(boost::uint32_t producer, T &&item){
+		BOOST_ASSERT(producer < mCount);
+		shard &current = mShards[producer];
+		//tryPush() only moves the item, when it is pushed.
+		if(!current.tryPush(std::move(item))){
+			Wait waiter(mParking);
+			while(!current.tryPush(std::move(item)))
+				waiter.wait();
+		}
+		notifyPushed(current);
+	}
+#endif
+
+	/*! \brief Push item to the shard of the producer, when it is not full.
+	 * 
+	 * Only one thread may push with the same producer index.
+	 * 
+	 * @param producer Producer index from addProducer().
+	 * @param item The item to push to the queue.
+	 * @return True, when the item is pushed. False, when the shard is full.
+	 */
+	bool tryPush(boost::uint32_t producer, const T &item){
+		BOOST_ASSERT(producer < mCount);
+		shard &current = mShards[producer];
+		if(!current.tryPush(item))
+			return false;
+		notifyPushed(current);
+		return true;
+	}
+
+	/*! \brief Pop item from the next non-empty shard.
+	 * 
+	 * Only one thread may pop.
+	 * 
+	 * @param item Item, where the popped item will be moved.
+	 * @return True, when success. False, when all shards are empty and signalNoMorePush() was called.
+	 */
+	bool pop(T &item){
+		Wait waiter(mParking);
+		bool noMorePush = false;
+		for(;;){
+			if(tryPop(item))
+				return true;
+			if(noMorePush)
+				return false;
+			//items pushed before signalNoMorePush() are still popped.
+			noMorePush = mNoMorePush.loadAcquire();
+			if(!noMorePush)
+				waiter.wait();
+		}
+	}
+
+	/*! \brief Pop item from the next non-empty shard, when it can be done without waiting.
+	 * 
+	 * Only one thread may pop.
+	 * 
+	 * @param item Item, where the popped item will be moved.
+	 * @return True, when success. False, when all shards are empty.
+	 */
+	bool tryPop(T &item){
+		for(boost::uint32_t i = 0; i < mCount; i++){
+			shard &current = mShards[mNext];
+			mNext = (mNext + 1) % mCount;
+			if(current.tryPop(item)){
+				mParking.notify();
+				return true;
+			}
+		}
+		return false;
+	}
+
+	/*! \brief Pop items from the shards.
+	 * 
+	 * Only one thread may pop.
+	 * It waits for data, then visits every shard once, round-robin, and takes a batch from each of them (maximum count together).
+	 * The next call continues with the shard after the last visited one.
+	 * 
+	 * @param out Output iterator, where the popped items will be moved.
+	 * @param count Maximum number of items to pop.
+	 * @return Number of popped items. Zero, when count is zero, or all shards are empty and signalNoMorePush() was called.
+	 */
+	template <class OutputIt>
+	std::size_t pop(OutputIt out, std::size_t count){
+		//nothing would be popped, it would wait forever.
+		if(count == 0)
+			return 0;
+		Wait waiter(mParking);
+		bool noMorePush = false;
+		for(;;){
+			std::size_t popped = tryPop(out, count);
+			if(popped != 0)
+				return popped;
+			if(noMorePush)
+				return 0;
+			noMorePush = mNoMorePush.loadAcquire();
+			if(!noMorePush)
+				waiter.wait();
+		}
+	}
+
+	/*! \brief Pop items from the shards, when it can be done without waiting.
+	 * 
+	 * Same as pop(OutputIt, std::size_t), but returns zero, when all shards are empty.
+	 * 
+	 * @param out Output iterator, where the popped items will be moved.
+	 * @param count Maximum number of items to pop.
+	 * @return Number of popped items.
+	 */
+	template <class OutputIt>
+	std::size_t tryPop(OutputIt out, std::size_t count){
+		std::size_t popped = 0;
+		for(boost::uint32_t i = 0; i < mCount && popped < count; i++){
+			std::size_t n;
+			out = mShards[mNext].tryPopTo(out, count - popped, n);
+			mNext = (mNext + 1) % mCount;
+			popped += n;
+		}
+		if(popped != 0)
+			mParking.notify();
+		return popped;
+	}
+
+	/*! \brief Pop item from queue and return the popped item.
+	 * 
+	 * Only one thread may pop.
+	 * Will throw exNoMorePush exception, when all shards are empty and signalNoMorePush() was called.
+	 * 
+	 * @return The item popped.
+	 */
+	T pop(){
+		Wait waiter(mParking);
+		bool noMorePush = false;
+		for(;;){
+			for(boost::uint32_t i = 0; i < mCount; i++){
+				shard &current = mShards[mNext];
+				mNext = (mNext + 1) % mCount;
+				if(current.getQueueLength() > 0){
+					T data(current.pop());
+					mParking.notify();
+					return data;
+				}
+			}
+			if(noMorePush)
+				throw exNoMorePush();
+			noMorePush = mNoMorePush.loadAcquire();
+			if(!noMorePush)
+				waiter.wait();
+		}
+	}
+
+	/*! \brief Close the queue for pushing.
+	 * 
+	 * Call it, when all producers are done, the popping thread will return, when all shards are empty.
+	 * 
+	 */
+	void signalNoMorePush(){
+		mNoMorePush.storeRelease(true);
+		mParking.notify();
+	}
+
+	/*! \brief Empty the queue and open it for pushing again.
+	 * 
+	 * Not thread-safe, no other thread may use the queue meanwhile.
+	 * The items of all shards are destroyed and signalNoMorePush() is cleared, the producers keep their shards.
+	 * 
+	 */
+	void reset(){
+		for(boost::uint32_t i = 0; i < mCount; i++){
+			mShards[i].reset();
+		}
+		mNext = 0;
+		mNoMorePush.storeRelease(false);
+	}
+
+	/*! \brief Gets the number of items in all shards.
+	 * 
+	 * It is only an estimate, while the producers are pushing.
+	 */
+	int getQueueLength(){
+		int length = 0;
+		for(boost::uint32_t i = 0; i < mCount; i++){
+			length += mShards[i].getQueueLength();
+		}
+		return length;
+	}
+
+	/*! \brief Gets the number of items in all shards, approximately.
+	 * 
+	 * Every shard is counted between 0 and size, so it is never negative.
+	 */
+	boost::uint32_t getSizeApprox(){
+		boost::uint32_t length = 0;
+		for(boost::uint32_t i = 0; i < mCount; i++){
+			length += mShards[i].getSizeApprox();
+		}
+		return length;
+	}
+
+	/*! \brief Checks, if all shards are empty.
+	 */
+	bool isEmpty(){
+		for(boost::uint32_t i = 0; i < mCount; i++){
+			if(!mShards[i].isEmpty())
+				return false;
+		}
+		return true;
+	}
+
+	/*! \brief Checks, if the next push of the producer would wait for a free slot.
+	 * 
+	 * @param producer Index of the producer.
+	 */
+	bool isFull(boost::uint32_t producer){
+		BOOST_ASSERT(producer < mCount);
+		return mShards[producer].isFull();
+	}
+
+	/*! \brief Gets the number of shards.
+	 */
+	boost::uint32_t getProducerCount() const {
+		return mCount;
+	}
+private:
+	sharded_circular_queue(const sharded_circular_queue&);
+	sharded_circular_queue& operator=(const sharded_circular_queue&);
+
+	//the shards never wait, the pushing and popping threads wait and notify only on mParking.
+	typedef spsc_circular_queue<T, size, spin_wait> shard;
+	typedef boost::integral_constant<bool, !boost::is_same<typename Wait::parking, circular_queue_detail::no_parking>::value> has_parking;
+
+	//wakes up the popping thread only, when the shard was empty before the push,
+	//so the producers don't touch the shared parking on every push.
+	void notifyPushed(shard &current){
+		notifyPushed(current, has_parking());
+	}
+	void notifyPushed(shard &, boost::false_type){ }
+	void notifyPushed(shard &current, boost::true_type){
+		//pairs with the fence in prepareWait() of the popping thread: either it sees our item, when it checks the shards
+		//before going to sleep, or we see, that it didn't pop the previous item, so it won't sleep on this shard.
+		circular_queue_detail::fenceSeqCst();
+		if(current.getQueueLength() <= 1)
+			mParking.notify();
+	}
+
+	void createShards(const memory_placement *placements){
+		BOOST_ASSERT(mCount != 0);
+		//mShards frees the created shards, when one of them throws.
+		mShards.reserve(mCount);
+		for(boost::uint32_t i = 0; i < mCount; i++){
+			mShards.create(placements ? placements[i] : memory_placement());
+		}
+	}
+
+	circular_queue_detail::placed_array<shard> mShards; // one for every producer
+	const boost::uint32_t mCount; // number of shards
+	boost::uint32_t mNext; // next shard to pop from, used only by the consumer
+	circular_queue_detail::atomic<boost::uint32_t> mProducers; // used by addProducer()
+	circular_queue_detail::atomic<bool> mNoMorePush;
+	typename Wait::parking mParking; //wakes up the popping thread for park_wait
+};
+
+#endif //SHARDED_CIRCULAR_QUEUE_H
@@ -0,0 +1,491 @@
+/**
+ * @file
+ * @author Peter Szucs <peter.szucs.dev@gmail.com>
+ *
+ * @section LICENSE
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @class spsc_circular_queue
+ * \brief Single-producer/single-consumer circular queue with cached positions.
+ * 
+ * Use this, when only one thread pushes and only one thread pops (pipeline stages).
+ * There are no flags in the slots, the two sides only communicate through the read and write positions,
+ * which are on separate cache lines. Both sides keep a local copy of the other side's position,
+ * and only read the shared one, when the queue looks full or empty. So in a steady stream,
+ * the cache lines of the positions won't bounce between the two threads on every item.
+ *
+ * example: see circular_queue_example.cpp, with 1 pushing and 1 popping thread.
+ */
+
+#ifndef SPSC_CIRCULAR_QUEUE_H
+#define SPSC_CIRCULAR_QUEUE_H
+
+#include "circular_queue.h"
+
+/*! \brief The single-producer/single-consumer circular queue.
+ * 
+ * Items are constructed in the slot at push, and destroyed in the slot at pop.
+ * 
+ * @tparam T Type of the items.
+ * @tparam size Number of slots, needs to be power of two.
+ * @tparam Wait Wait strategy: default_wait, spin_wait, spin_yield_wait, backoff_wait, spin_sleep_wait or park_wait.
+ */
+template <typename T, boost::uint32_t size = 32u, typename Wait = default_wait>
+class spsc_circular_queue {
+public:
+	spsc_circular_queue()
+	{
+		mProducer.value.cachedReadPos = 0;
+		mConsumer.value.cachedWritePos = 0;
+
+		// 0x100000000 needs to be dividable by size or it will fail on overflow.
+		BOOST_STATIC_ASSERT( (0xFFFFFFFFu % size) == (size - 1) );
+	}
+
+	~spsc_circular_queue(){
+		destroyItems();
+	}
+
+	/*! \brief Push item to queue.
+	 * 
+	 * Only one thread may push.
+	 * 
+	 * @param item The item to push to the queue.
+	 */
+	void push(const T &item){
+		boost::uint32_t mypos = claimPushSlot();
+		new (mSlots[mypos % size].get()) T(item);
+		publishPushSlot(mypos);
+	}
+#ifndef BOOST_NO_CXX11_RVALUE_REFERENCES
+	/*! \brief Push item to queue.
+	 * 
+	 * Only one thread may push, the item is moved into the queue.
+	 * 
+	 * @param item The item to push to the queue.
+	 */
+	void push(T &&item){
+		boost::uint32_t mypos = claimPushSlot();
+		new (mSlots[mypos % size].get()) T(std::move(item));
+		publishPushSlot(mypos);
+	}
+#endif
+#if !defined(BOOST_NO_CXX11_RVALUE_REFERENCES) && !defined(BOOST_NO_CXX11_VARIADIC_TEMPLATES)
+	/*! \brief Construct item in the queue.
+	 * 
+	 * Only one thread may push, the item is constructed directly in the slot of the queue.
+	 * 
+	 * @param args Arguments for the constructor of T.
+	 */
+	template <class... Args>
+	void emplace(Args&&... args){
+		boost::uint32_t mypos = claimPushSlot();
+		new (mSlots[mypos % size].get()) T(std::forward<Args>(args)...);
+		publishPushSlot(mypos);
+	}
+#endif
+
+	/*! \brief Push items to queue.
+	 * 
+	 * Only one thread may push.
+	 * The free slots are written in one step, and the write position is published once for them.
+	 * When T is trivially copyable, the items are copied with one memcpy() until the end of the slot array.
+	 * Waits, when the queue is full.
+	 * 
+	 * @param items The items to push to the queue.
+	 * @param count Number of items.
+	 */
+	void push(const T *items, std::size_t count){
+		while(count != 0){
+			boost::uint32_t mypos = claimPushSlot();
+			//free slots until the end of the slot array.
+			boost::uint32_t ready = size - (mypos - mProducer.value.cachedReadPos);
+			if(size - mypos % size < ready)
+				ready = size - mypos % size;
+			if(count < ready)
+				ready = (boost::uint32_t)count;
+			constructItems(mSlots[mypos % size].get(), items, ready, bulk_copy());
+			mProducer.value.writePos.storeRelease(mypos + ready);
+			mParking.notify();
+			items += ready;
+			count -= ready;
+		}
+	}
+
+	/*! \brief Push item to queue, when it is not full.
+	 * 
+	 * Only one thread may push.
+	 * 
+	 * @param item The item to push to the queue.
+	 * @return True, when the item is pushed. False, when queue is full.
+	 */
+	bool tryPush(const T &item){
+		boost::uint32_t mypos = mProducer.value.writePos.loadRelaxed();
+		if(isFullAt(mypos))
+			return false;
+		new (mSlots[mypos % size].get()) T(item);
+		publishPushSlot(mypos);
+		return true;
+	}
+#ifndef BOOST_NO_CXX11_RVALUE_REFERENCES
+	/*! \brief Push item to queue, when it is not full.
+	 * 
+	 * Only one thread may push, the item is only moved, when it is pushed.
+	 * 
+	 * @param item The item to push to the queue.
+	 * @return True, when the item is pushed. False, when queue is full.
+	 */
+	bool tryPush(T &&item){
+		boost::uint32_t mypos = mProducer.value.writePos.loadRelaxed();
+		if(isFullAt(mypos))
+			return false;
+		new (mSlots[mypos % size].get()) T(std::move(item));
+		publishPushSlot(mypos);
+		return true;
+	}
+#endif
+
+	/*! \brief Reserve the next slot for writing the item in place.
+	 * 
+	 * Only one thread may push, and only one slot can be reserved at a time.
+	 * The returned memory is not a constructed object, you need to construct T in it (placement new,
+	 * or write it directly, when T is trivially copyable, e.g. recv() into it), then call commitPush().
+	 * 
+	 * @return Pointer to the storage of the slot.
+	 */
+	T* reservePush(){
+		return mSlots[claimPushSlot() % size].get();
+	}
+
+	/*! \brief Publish the item written to the slot got from reservePush().
+	 */
+	void commitPush(){
+		publishPushSlot(mProducer.value.writePos.loadRelaxed());
+	}
+
+	/*! \brief Pop item from queue.
+	 * 
+	 * Only one thread may pop.
+	 * 
+	 * @param item Item, where the popped item will be moved.
+	 * @return True, when success. False, when queue is empty and signalNoMorePush() was called.
+	 */
+	bool pop(T &item){
+		boost::uint32_t mypos;
+		if(!claimPopSlot(mypos))
+			return false;
+		item = boost::move(*mSlots[mypos % size].get());
+		freePopSlot(mypos);
+		return true;
+	}
+
+	/*! \brief Pop item from queue, when it is not empty.
+	 * 
+	 * Only one thread may pop.
+	 * 
+	 * @param item Item, where the popped item will be moved.
+	 * @return True, when success. False, when queue is empty.
+	 */
+	bool tryPop(T &item){
+		boost::uint32_t mypos = mConsumer.value.readPos.loadRelaxed();
+		if(isEmptyAt(mypos))
+			return false;
+		item = boost::move(*mSlots[mypos % size].get());
+		freePopSlot(mypos);
+		return true;
+	}
+
+	/*! \brief Get the next item in place, without moving it out of the queue.
+	 * 
+	 * Only one thread may pop, and only one item can be peeked at a time.
+	 * The item stays in the slot, until releasePop() is called.
+	 * 
+	 * @return Pointer to the item. NULL, when queue is empty and signalNoMorePush() was called.
+	 */
+	const T* peekPop(){
+		boost::uint32_t mypos;
+		if(!claimPopSlot(mypos))
+			return NULL;
+		return mSlots[mypos % size].get();
+	}
+
+	/*! \brief Destroy the item got from peekPop() and free its slot.
+	 */
+	void releasePop(){
+		freePopSlot(mConsumer.value.readPos.loadRelaxed());
+	}
+
+	/*! \brief Pop items from queue, when it is not empty.
+	 * 
+	 * Only one thread may pop.
+	 * The shared write position is read at most once, and the read position is written once for all items.
+	 * 
+	 * @param out Output iterator, where the popped items will be moved.
+	 * @param count Maximum number of items to pop.
+	 * @return Number of popped items. Zero, when queue is empty.
+	 */
+	template <class OutputIt>
+	std::size_t tryPop(OutputIt out, std::size_t count){
+		std::size_t popped;
+		tryPopTo(out, count, popped);
+		return popped;
+	}
+
+	/*! \brief Pop items from queue, when it is not empty, and get the iterator after them.
+	 * 
+	 * Same as tryPop(OutputIt, std::size_t), but the caller can continue writing with the returned iterator,
+	 * also when it is not forward iterator.
+	 * 
+	 * @param out Output iterator, where the popped items will be moved.
+	 * @param count Maximum number of items to pop.
+	 * @param popped Number of popped items. Zero, when queue is empty.
+	 * @return The output iterator after the popped items.
+	 */
+	template <class OutputIt>
+	OutputIt tryPopTo(OutputIt out, std::size_t count, std::size_t &popped){
+		popped = 0;
+		boost::uint32_t pos = mConsumer.value.readPos.loadRelaxed();
+		if(isEmptyAt(pos))
+			return out;
+		boost::uint32_t ready = mConsumer.value.cachedWritePos - pos;
+		if(count < ready)
+			ready = (boost::uint32_t)count;
+		for(boost::uint32_t i = 0; i < ready; i++, pos++, ++out){
+			T *item = mSlots[pos % size].get();
+			*out = boost::move(*item);
+			item->~T();
+		}
+		mConsumer.value.readPos.storeRelease(pos);
+		mParking.notify();
+		popped = ready;
+		return out;
+	}
+
+	/*! \brief Pop items from queue to an array, when it is not empty.
+	 * 
+	 * Same as tryPop(OutputIt, std::size_t), but when T is trivially copyable, the items are copied with one memcpy() until the end of the slot array.
+	 * 
+	 * @param out Array, where the popped items will be moved.
+	 * @param count Maximum number of items to pop.
+	 * @return Number of popped items. Zero, when queue is empty.
+	 */
+	std::size_t tryPop(T *out, std::size_t count){
+		return popItems(out, count, bulk_copy());
+	}
+
+	/*! \brief Pop item from queue and return the popped item.
+	 * 
+	 * Only one thread may pop.
+	 * Will throw exNoMorePush exception, when queue is empty and signalNoMorePush() was called.
+	 * 
+	 * @return The item popped.
+	 */
+	T pop(){
+		boost::uint32_t mypos;
+		if(!claimPopSlot(mypos))
+			throw exNoMorePush();
+		T data(boost::move(*mSlots[mypos % size].get()));
+		freePopSlot(mypos);
+		return data;
+	}
+
+	/*! \brief Close the queue for pushing.
+	 * 
+	 * When you don't want to push any more data, you can call this, and the popping thread will return, when the queue is empty.
+	 * 
+	 */
+	void signalNoMorePush(){
+		mNoMorePush.storeRelease(true);
+		mParking.notify();
+	}
+
+	/*! \brief Empty the queue and open it for pushing again.
+	 * 
+	 * Not thread-safe, no other thread may use the queue meanwhile.
+	 * The items are destroyed, the positions are set back to zero and signalNoMorePush() is cleared.
+	 * 
+	 */
+	void reset(){
+		destroyItems();
+		mProducer.value.writePos.storeRelaxed(0);
+		mProducer.value.cachedReadPos = 0;
+		mConsumer.value.readPos.storeRelaxed(0);
+		mConsumer.value.cachedWritePos = 0;
+		mNoMorePush.storeRelease(false);
+	}
+
+	/*! \brief Gets the length of the queue
+	 * 
+	 * It is exact, when called from the pushing or popping thread.
+	 */
+	int getQueueLength(){
+		return (int)(mProducer.value.writePos.loadAcquire() - mConsumer.value.readPos.loadAcquire());
+	}
+
+	/*! \brief Gets the number of items in the queue, approximately.
+	 * 
+	 * Same as getQueueLength(), but it is never negative and never bigger than size, when called from other threads.
+	 */
+	boost::uint32_t getSizeApprox(){
+		boost::uint32_t readPos = mConsumer.value.readPos.loadAcquire();
+		boost::int32_t length = (boost::int32_t)(mProducer.value.writePos.loadAcquire() - readPos);
+		if(length <= 0)
+			return 0;
+		if(length >= (boost::int32_t)size)
+			return size;
+		return (boost::uint32_t)length;
+	}
+
+	/*! \brief Checks, if there is no item to pop.
+	 */
+	bool isEmpty(){
+		return mProducer.value.writePos.loadAcquire() == mConsumer.value.readPos.loadAcquire();
+	}
+
+	/*! \brief Checks, if the next push would wait for a free slot.
+	 */
+	bool isFull(){
+		return mProducer.value.writePos.loadAcquire() - mConsumer.value.readPos.loadAcquire() == size;
+	}
+
+	/*! \brief Checks, if signalNoMorePush() was called and all pushed items are popped.
+	 */
+	bool isDrained(){
+		return mNoMorePush.loadAcquire() && isEmpty();
+	}
+
+	/*! \brief Gets the parking of the queue, it is notified after every push and pop.
+	 * 
+	 * Used by circular_queue_set, to wake up a thread waiting on more queues.
+	 */
+	typename Wait::parking& getParking(){
+		return mParking;
+	}
+
+	/*! \brief Gets the number of slots in the queue.
+	 */
+	boost::uint32_t getCapacity() const {
+		return size;
+	}
+private:
+	typedef circular_queue_detail::is_bulk_copyable<T> bulk_copy;
+
+	void constructItems(T *to, const T *items, boost::uint32_t count, boost::false_type){
+		for(boost::uint32_t i = 0; i < count; i++){
+			new (to + i) T(items[i]);
+		}
+	}
+	void constructItems(T *to, const T *items, boost::uint32_t count, boost::true_type){
+		circular_queue_detail::copyItems(to, items, count);
+	}
+	std::size_t popItems(T *out, std::size_t count, boost::false_type){
+		return tryPop<T*>(out, count);
+	}
+	std::size_t popItems(T *out, std::size_t count, boost::true_type){
+		boost::uint32_t pos = mConsumer.value.readPos.loadRelaxed();
+		if(isEmptyAt(pos))
+			return 0;
+		boost::uint32_t ready = mConsumer.value.cachedWritePos - pos;
+		if(count < ready)
+			ready = (boost::uint32_t)count;
+		//split at the end of the slot array.
+		boost::uint32_t first = size - pos % size;
+		if(ready < first)
+			first = ready;
+		std::memcpy(out, mSlots[pos % size].get(), first * sizeof(T));
+		std::memcpy(out + first, mSlots[0].get(), (ready - first) * sizeof(T));
+		mConsumer.value.readPos.storeRelease(pos + ready);
+		mParking.notify();
+		return ready;
+	}
+
+	void destroyItems(){
+		boost::uint32_t end = mProducer.value.writePos.loadRelaxed();
+		for(boost::uint32_t pos = mConsumer.value.readPos.loadRelaxed(); pos != end; pos++){
+			mSlots[pos % size].get()->~T();
+		}
+	}
+
+	//checks the cached read position first, the shared one is only read, when it looks full.
+	bool isFullAt(boost::uint32_t mypos){
+		if(mypos - mProducer.value.cachedReadPos != size)
+			return false;
+		mProducer.value.cachedReadPos = mConsumer.value.readPos.loadAcquire();
+		return mypos - mProducer.value.cachedReadPos == size;
+	}
+	//checks the cached write position first, the shared one is only read, when it looks empty.
+	bool isEmptyAt(boost::uint32_t mypos){
+		if(mypos != mConsumer.value.cachedWritePos)
+			return false;
+		mConsumer.value.cachedWritePos = mProducer.value.writePos.loadAcquire();
+		return mypos == mConsumer.value.cachedWritePos;
+	}
+	boost::uint32_t claimPushSlot(){
+		BOOST_ASSERT(!mNoMorePush.loadRelaxed());
+		boost::uint32_t mypos = mProducer.value.writePos.loadRelaxed();
+		if(isFullAt(mypos)){
+			Wait waiter(mParking);
+			//queue is full, wait for the popping thread.
+			while(isFullAt(mypos)){
+				waiter.wait();
+			}
+		}
+		return mypos;
+	}
+	void publishPushSlot(boost::uint32_t mypos){
+		mProducer.value.writePos.storeRelease(mypos + 1);
+		mParking.notify();
+	}
+	bool claimPopSlot(boost::uint32_t &mypos){
+		mypos = mConsumer.value.readPos.loadRelaxed();
+		if(isEmptyAt(mypos)){
+			Wait waiter(mParking);
+			//queue is empty, wait for data.
+			while(isEmptyAt(mypos)){
+				if(mNoMorePush.loadAcquire())
+					return !isEmptyAt(mypos);
+				waiter.wait();
+			}
+		}
+		return true;
+	}
+	void freePopSlot(boost::uint32_t mypos){
+		mSlots[mypos % size].get()->~T();
+		mConsumer.value.readPos.storeRelease(mypos + 1);
+		mParking.notify();
+	}
+
+	struct producer {
+		circular_queue_detail::atomic<boost::uint32_t> writePos; // push position, written by the producer
+		boost::uint32_t cachedReadPos; // last seen pop position, used only by the producer
+	};
+	struct consumer {
+		circular_queue_detail::atomic<boost::uint32_t> readPos; // pop position, written by the consumer
+		boost::uint32_t cachedWritePos; // last seen push position, used only by the consumer
+	};
+
+	circular_queue_detail::layout_cell<producer, padded_layout> mProducer;
+	circular_queue_detail::layout_cell<consumer, padded_layout> mConsumer;
+	circular_queue_detail::slot_storage<T> mSlots[size];
+	circular_queue_detail::atomic<bool> mNoMorePush;
+	typename Wait::parking mParking; //wakes up sleeping threads for park_wait
+};
+
+#endif //SPSC_CIRCULAR_QUEUE_H
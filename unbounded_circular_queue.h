@@ -0,0 +1,487 @@
+/**
+ * @file
+ * @author Peter Szucs <peter.szucs.dev@gmail.com>
+ *
+ * @section LICENSE
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @class unbounded_circular_queue
+ * \brief Multi-producer/multi-consumer queue, which grows with linked segments.
+ * 
+ * Use this, when you can't know, how many items will be pushed (bursts).
+ * The items are stored in fixed size ring segments, the positions in a segment are taken with atomic increment,
+ * like in circular_queue. When the last segment is full, a new one is linked after it.
+ * The drained segments are put to a free-list and reused, so in steady state there are no allocations.
+ * Linking and unlinking is the slow path (once per segmentSize items), it is done with a mutex.
+ * With maxSegments the queue can be limited, then push() waits, like circular_queue does, when it is full.
+ *
+ * example: see circular_queue_example.cpp, it works the same with unbounded_circular_queue<int> tasks.
+ */
+
+#ifndef UNBOUNDED_CIRCULAR_QUEUE_H
+#define UNBOUNDED_CIRCULAR_QUEUE_H
+
+#include "circular_queue.h"
+#include <boost/align/aligned_alloc.hpp> //aligned_alloc()
+#include <new> //bad_alloc
+
+namespace circular_queue_detail {
+	//mask of the lowest bits, which can hold the values up to n.
+	template <boost::uint32_t n, boost::uint32_t mask = 1u, bool fits = (n <= mask)>
+	struct low_bits_mask {
+		static const boost::uint32_t value = low_bits_mask<n, mask * 2 + 1>::value;
+	};
+	template <boost::uint32_t n, boost::uint32_t mask>
+	struct low_bits_mask<n, mask, true> {
+		static const boost::uint32_t value = mask;
+	};
+}
+
+/*! \brief The unbounded circular queue.
+ * 
+ * @tparam T Type of the items.
+ * @tparam segmentSize Number of slots in one segment.
+ * @tparam Wait Wait strategy: default_wait, spin_wait, spin_yield_wait, backoff_wait, spin_sleep_wait or park_wait.
+ */
+template <typename T, boost::uint32_t segmentSize = 256u, typename Wait = default_wait>
+class unbounded_circular_queue {
+public:
+	/*! \brief Creates the queue with one segment.
+	 * 
+	 * @param maxSegments Soft cap for backpressure: maximum number of segments in use, 0 means no limit, otherwise at least 2.
+	 */
+	explicit unbounded_circular_queue(boost::uint32_t maxSegments = 0) :
+		mMaxSegments(maxSegments),
+		mFree(NULL)
+	{
+		BOOST_STATIC_ASSERT( segmentSize != 0 );
+		//the rest of the bits in readIdx count the reuses of the segment.
+		BOOST_STATIC_ASSERT( segmentSize <= (1u << 20) );
+		//the head segment is only unlinked, when the next one exists.
+		BOOST_ASSERT(maxSegments == 0 || maxSegments >= 2);
+		segment *first = newSegment();
+		mHead.value.storeRelaxed(first);
+		mTail.value.storeRelaxed(first);
+		mSegmentCount.storeRelaxed(1);
+	}
+
+	~unbounded_circular_queue(){
+		segment *seg = mHead.value.loadRelaxed();
+		while(seg){
+			segment *next = seg->next.loadRelaxed();
+			for(boost::uint32_t i = 0; i < segmentSize; i++){
+				if(seg->slots[i].hasData.loadRelaxed())
+					seg->slots[i].data.get()->~T();
+			}
+			deleteSegment(seg);
+			seg = next;
+		}
+		while(mFree){
+			segment *next = mFree->freeNext;
+			deleteSegment(mFree);
+			mFree = next;
+		}
+	}
+
+	/*! \brief Push item to queue.
+	 * 
+	 * Thread-safe push. It only waits, when maxSegments is reached.
+	 * 
+	 * @param item The item to push to the queue.
+	 */
+	void push(const T &item){
+		boost::uint32_t idx;
+		segment *seg = claimPushSlot(idx, true);
+		new (seg->slots[idx].data.get()) T(item);
+		publishPushSlot(seg, idx);
+	}
+#ifndef BOOST_NO_CXX11_RVALUE_REFERENCES
+	/*! \brief Push item to queue.
+	 * 
+	 * Thread-safe push, the item is moved into the queue.
+	 * 
+	 * @param item The item to push to the queue.
+	 */
+	void push(T &&item){
+		boost::uint32_t idx;
+		segment *seg = claimPushSlot(idx, true);
+		new (seg->slots[idx].data.get()) T(std::move(item));
+		publishPushSlot(seg, idx);
+	}
+#endif
+#if !defined(BOOST_NO_CXX11_RVALUE_REFERENCES) && !defined(BOOST_NO_CXX11_VARIADIC_TEMPLATES)
+	/*! \brief Construct item in the queue.
+	 * 
+	 * Thread-safe push, the item is constructed directly in the slot of the queue.
+	 * 
+	 * @param args Arguments for the constructor of T.
+	 */
+	template <class... Args>
+	void emplace(Args&&... args){
+		boost::uint32_t idx;
+		segment *seg = claimPushSlot(idx, true);
+		new (seg->slots[idx].data.get()) T(std::forward<Args>(args)...);
+		publishPushSlot(seg, idx);
+	}
+#endif
+
+	/*! \brief Push item to queue, when maxSegments is not reached.
+	 * 
+	 * Thread-safe push, it can be mixed with push().
+	 * 
+	 * @param item The item to push to the queue.
+	 * @return True, when the item is pushed. False, when a new segment would be needed over maxSegments.
+	 */
+	bool tryPush(const T &item){
+		boost::uint32_t idx;
+		segment *seg = claimPushSlot(idx, false);
+		if(!seg)
+			return false;
+		new (seg->slots[idx].data.get()) T(item);
+		publishPushSlot(seg, idx);
+		return true;
+	}
+
+	/*! \brief Pop item from queue.
+	 * 
+	 * Thread-safe pop.
+	 * 
+	 * @param item Item, where the popped item will be moved.
+	 * @return True, when success. False, when queue is empty and signalNoMorePush() was called.
+	 */
+	bool pop(T &item){
+		boost::uint32_t idx;
+		segment *seg = claimPopSlot(idx);
+		if(!seg)
+			return false;
+		item = boost::move(*seg->slots[idx].data.get());
+		freePopSlot(seg, idx);
+		return true;
+	}
+
+	/*! \brief Pop item from queue, when it can be done without waiting.
+	 * 
+	 * Thread-safe pop, it can be mixed with pop().
+	 * 
+	 * @param item Item, where the popped item will be moved.
+	 * @return True, when success. False, when queue is empty.
+	 */
+	bool tryPop(T &item){
+		boost::uint32_t idx;
+		segment *seg = tryClaimPopSlot(idx);
+		if(!seg)
+			return false;
+		item = boost::move(*seg->slots[idx].data.get());
+		freePopSlot(seg, idx);
+		return true;
+	}
+
+	/*! \brief Pop item from queue and return the popped item.
+	 * 
+	 * Thread-safe pop.
+	 * Will throw exNoMorePush exception, when queue is empty and signalNoMorePush() was called.
+	 * 
+	 * @return The item popped.
+	 */
+	T pop(){
+		boost::uint32_t idx;
+		segment *seg = claimPopSlot(idx);
+		if(!seg)
+			throw exNoMorePush();
+		T data(boost::move(*seg->slots[idx].data.get()));
+		freePopSlot(seg, idx);
+		return data;
+	}
+
+	/*! \brief Close the queue for pushing.
+	 * 
+	 * When you don't want to push any more data, you can call this, and the popping threads will return, when the queue is empty.
+	 * Items of pushes, which have taken their slot before this call, are still popped.
+	 * 
+	 */
+	void signalNoMorePush(){
+		mNoMorePush.storeRelease(true);
+		mParking.notify();
+	}
+
+	/*! \brief Empty the queue and open it for pushing again.
+	 * 
+	 * Not thread-safe, no other thread may use the queue meanwhile.
+	 * The remaining items are destroyed, only the head segment stays linked, the others are put to the free-list,
+	 * and signalNoMorePush() is cleared.
+	 * 
+	 */
+	void reset(){
+		segment *first = mHead.value.loadRelaxed();
+		for(segment *seg = first; seg; ){
+			segment *next = seg->next.loadRelaxed();
+			for(boost::uint32_t i = 0; i < segmentSize; i++){
+				if(seg->slots[i].hasData.loadRelaxed()){
+					seg->slots[i].data.get()->~T();
+					seg->slots[i].hasData.storeRelaxed(false);
+				}
+			}
+			if(seg != first){
+				//same as a recycled segment, see struct segment.
+				seg->writeIdx.value.storeRelaxed(segmentSize);
+				seg->readIdx.value.storeRelaxed(segmentSize);
+				seg->freeNext = mFree;
+				mFree = seg;
+			}
+			seg = next;
+		}
+		first->writeIdx.value.storeRelaxed(0);
+		first->readIdx.value.storeRelaxed(0);
+		first->done.storeRelaxed(0);
+		first->next.storeRelaxed(NULL);
+		mTail.value.storeRelaxed(first);
+		mSegmentCount.storeRelaxed(1);
+		mNoMorePush.storeRelease(false);
+	}
+
+	/*! \brief Gets the estimated length of the queue
+	 * 
+	 * It is only exact, when no thread is pushing or popping.
+	 */
+	int getQueueLength(){
+		boost::uint32_t writeIdx = mTail.value.loadAcquire()->writeIdx.value.loadRelaxed();
+		boost::uint32_t readIdx = mHead.value.loadAcquire()->readIdx.value.loadRelaxed() & indexMask;
+		if(writeIdx > segmentSize)
+			writeIdx = segmentSize;
+		if(readIdx > segmentSize)
+			readIdx = segmentSize;
+		return (int)((mSegmentCount.loadRelaxed() - 1) * segmentSize + writeIdx) - (int)readIdx;
+	}
+
+	/*! \brief Gets the number of segments in use.
+	 */
+	boost::uint32_t getSegmentCount(){
+		return mSegmentCount.loadRelaxed();
+	}
+private:
+	unbounded_circular_queue(const unbounded_circular_queue&);
+	unbounded_circular_queue& operator=(const unbounded_circular_queue&);
+
+	struct slot {
+		circular_queue_detail::slot_storage<T> data;
+		circular_queue_detail::atomic<bool> hasData;
+	};
+	/* Threads may still increase writeIdx of a segment after it is drained, because they have read mTail before.
+	 * So segments are only freed in the destructor, and in the free-list both indices are at least segmentSize,
+	 * so these threads will see it full and retry.
+	 * The popping threads can't do the same, a pop from a reused segment would overtake the older items.
+	 * So readIdx is only changed with compareExchange(), and its bits above indexMask are the generation,
+	 * which is increased, when the segment is reused. A thread with an old mHead fails the exchange,
+	 * and the segment is checked to be the head, after readIdx is read.
+	 */
+	struct segment {
+		circular_queue_detail::layout_cell<circular_queue_detail::atomic<boost::uint32_t>, padded_layout> writeIdx; // taken push slots
+		circular_queue_detail::layout_cell<circular_queue_detail::atomic<boost::uint32_t>, padded_layout> readIdx; // taken pop slots, and the generation in the high bits
+		circular_queue_detail::atomic<boost::uint32_t> done; // popped slots, +1 when it is unlinked
+		circular_queue_detail::atomic<segment*> next; // next segment in the queue
+		segment *freeNext; // next segment in the free-list
+		slot slots[segmentSize];
+	};
+	static const boost::uint32_t indexMask = circular_queue_detail::low_bits_mask<segmentSize>::value; // slot index in readIdx
+
+	//first slot index of the next generation.
+	static boost::uint32_t nextGeneration(boost::uint32_t readIdx){
+		return (readIdx | indexMask) + 1;
+	}
+
+	segment* newSegment(){
+		void *memory = boost::alignment::aligned_alloc(boost::alignment_of<segment>::value, sizeof(segment));
+		if(!memory)
+			throw std::bad_alloc();
+		return new (memory) segment();
+	}
+	void deleteSegment(segment *seg){
+		seg->~segment();
+		boost::alignment::aligned_free(seg);
+	}
+
+	segment* claimPushSlot(boost::uint32_t &idx, bool wait){
+		BOOST_ASSERT(!mNoMorePush.loadRelaxed());
+		for(;;){
+			segment *seg = mTail.value.loadAcquire();
+			idx = seg->writeIdx.value.fetchAdd(1);
+			if(idx < segmentSize)
+				return seg;
+			//segment is full, link a new one.
+			if(!appendSegment(seg, wait))
+				return NULL;
+		}
+	}
+	//returns false, when maxSegments is reached and wait is false.
+	bool appendSegment(segment *seg, bool wait){
+		Wait waiter(mParking);
+		for(;;){
+			{
+				boost::lock_guard<boost::mutex> lock(mMutex);
+				//other thread was faster, or seg is already in the free-list.
+				if(mTail.value.loadRelaxed() != seg || seg->writeIdx.value.loadRelaxed() < segmentSize)
+					return true;
+				if(mMaxSegments == 0 || mSegmentCount.loadRelaxed() < mMaxSegments){
+					segment *next = mFree;
+					if(next){
+						mFree = next->freeNext;
+						next->done.storeRelaxed(0);
+						next->next.storeRelaxed(NULL);
+						//late pushing threads will get valid slots from here, the popping threads fail on the generation.
+						next->readIdx.value.storeRelease(nextGeneration(next->readIdx.value.loadRelaxed()));
+						next->writeIdx.value.storeRelease(0);
+					} else {
+						next = newSegment();
+					}
+					seg->next.storeRelease(next);
+					mTail.value.storeRelease(next);
+					mSegmentCount.storeRelaxed(mSegmentCount.loadRelaxed() + 1);
+					return true;
+				}
+			}
+			if(!wait)
+				return false;
+			//queue is full, wait for workers.
+			waiter.wait();
+		}
+	}
+	void publishPushSlot(segment *seg, boost::uint32_t idx){
+		seg->slots[idx].hasData.storeRelease(true);
+		mParking.notify();
+	}
+
+	segment* claimPopSlot(boost::uint32_t &idx){
+		Wait waiter(mParking);
+		for(;;){
+			boost::uint32_t readIdx;
+			segment *seg = loadHead(readIdx);
+			idx = readIdx & indexMask;
+			if(idx < segmentSize){
+				if(!seg->readIdx.value.compareExchange(readIdx, readIdx + 1))
+					continue;
+				//queue is empty, wait for data.
+				while(!seg->slots[idx].hasData.loadAcquire()){
+					if(isDrainedAt(seg, idx)){
+						releasePopSlot(seg);
+						return NULL;
+					}
+					waiter.wait();
+				}
+				return seg;
+			}
+			//all slots of the segment are taken, go to the next one.
+			bool noMorePush = mNoMorePush.loadAcquire();
+			if(!advanceHead(seg)){
+				if(noMorePush)
+					return NULL;
+				waiter.wait();
+			}
+		}
+	}
+	segment* tryClaimPopSlot(boost::uint32_t &idx){
+		for(;;){
+			boost::uint32_t readIdx;
+			segment *seg = loadHead(readIdx);
+			idx = readIdx & indexMask;
+			if(idx >= segmentSize){
+				if(!advanceHead(seg))
+					return NULL;
+				continue;
+			}
+			if(!seg->slots[idx].hasData.loadAcquire()){
+				if(seg->readIdx.value.loadRelaxed() == readIdx)
+					return NULL;
+				continue;
+			}
+			//the generation is the same, so the checked data is in our slot.
+			if(seg->readIdx.value.compareExchange(readIdx, readIdx + 1))
+				return seg;
+		}
+	}
+	//reads the head segment and its readIdx, which belongs to it, while it is the head.
+	segment* loadHead(boost::uint32_t &readIdx){
+		for(;;){
+			segment *seg = mHead.value.loadAcquire();
+			readIdx = seg->readIdx.value.loadAcquire();
+			//seg may be reused as a later segment, after we have read mHead.
+			if(mHead.value.loadAcquire() == seg)
+				return seg;
+		}
+	}
+	//returns false, when there is no next segment yet.
+	bool advanceHead(segment *seg){
+		boost::lock_guard<boost::mutex> lock(mMutex);
+		//other thread was faster, or seg is already in the free-list.
+		if(mHead.value.loadRelaxed() != seg || (seg->readIdx.value.loadRelaxed() & indexMask) < segmentSize)
+			return true;
+		segment *next = seg->next.loadAcquire();
+		if(!next)
+			return false;
+		mHead.value.storeRelease(next);
+		if(releaseSegment(seg))
+			recycleSegment(seg);
+		return true;
+	}
+	void freePopSlot(segment *seg, boost::uint32_t idx){
+		seg->slots[idx].data.get()->~T();
+		seg->slots[idx].hasData.storeRelease(false);
+		releasePopSlot(seg);
+	}
+	//true, when signalNoMorePush() was called and no push has taken the slot, so data will never come for it.
+	//a push, which has taken its slot before signalNoMorePush(), is still waited for.
+	bool isDrainedAt(segment *seg, boost::uint32_t idx){
+		if(!mNoMorePush.loadAcquire())
+			return false;
+		return seg->writeIdx.value.loadAcquire() <= idx;
+	}
+	//counts the slot as done, also when it is drained without data, otherwise the segment is never recycled.
+	void releasePopSlot(segment *seg){
+		if(releaseSegment(seg)){
+			boost::lock_guard<boost::mutex> lock(mMutex);
+			recycleSegment(seg);
+		}
+	}
+	//true, when all slots are popped and the segment is unlinked.
+	bool releaseSegment(segment *seg){
+		//exchange is acq_rel, so the last one sees, that the other threads are done with their slots.
+		boost::uint32_t done = seg->done.loadRelaxed();
+		while(!seg->done.compareExchange(done, done + 1)){ }
+		return done == segmentSize;
+	}
+	//needs mMutex.
+	void recycleSegment(segment *seg){
+		seg->freeNext = mFree;
+		mFree = seg;
+		mSegmentCount.storeRelaxed(mSegmentCount.loadRelaxed() - 1);
+		//wakes up the threads waiting for maxSegments.
+		mParking.notify();
+	}
+
+	const boost::uint32_t mMaxSegments; // 0 means no limit
+	circular_queue_detail::layout_cell<circular_queue_detail::atomic<segment*>, padded_layout> mHead; // pop segment
+	circular_queue_detail::layout_cell<circular_queue_detail::atomic<segment*>, padded_layout> mTail; // push segment
+	circular_queue_detail::atomic<boost::uint32_t> mSegmentCount; // linked segments, written with mMutex
+	segment *mFree; // free-list, used with mMutex
+	boost::mutex mMutex; // used only for linking and unlinking segments
+	circular_queue_detail::atomic<bool> mNoMorePush;
+	typename Wait::parking mParking; //wakes up sleeping threads for park_wait
+};
+
+#endif //UNBOUNDED_CIRCULAR_QUEUE_H
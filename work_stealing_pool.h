@@ -0,0 +1,239 @@
+/**
+ * @file
+ * @author Peter Szucs <peter.szucs.dev@gmail.com>
+ *
+ * @section LICENSE
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @class work_stealing_pool
+ * \brief Thread pool with a work_stealing_queue for every worker.
+ * 
+ * Tasks submitted from a worker thread go to the worker's own deque, so hot tasks stay on the same core.
+ * Tasks submitted from other threads go to a shared circular_queue.
+ * Idle workers take from the shared queue first, then steal from the other workers.
+ * With NUMA placements, every worker's deque is on its node, and they steal from the workers of the same node first.
+ * The destructor waits, until all submitted tasks are done.
+ * Tasks must not throw exceptions on the workers, it terminates the process like in any boost::thread.
+ * When submit() runs the task on the calling thread, the exception goes to the caller, the task is counted as done.
+ *
+ * example:
+ * 	work_stealing_pool<> pool(4);
+ * 	pool.submit(boost::bind(&doWork, 42));
+ * 	pool.waitIdle();
+ */
+
+#ifndef WORK_STEALING_POOL_H
+#define WORK_STEALING_POOL_H
+
+#include "circular_queue.h"
+#include "work_stealing_queue.h"
+#include <boost/function.hpp>
+#include <boost/bind/bind.hpp>
+#include <boost/thread/tss.hpp> //thread_specific_ptr
+
+/*! \brief The work-stealing thread pool.
+ * 
+ * @tparam size Number of slots in each worker's deque and in the shared queue, needs to be power of two.
+ * @tparam Wait Wait strategy of the idle workers and waitIdle(): default_wait, spin_wait, spin_yield_wait, backoff_wait, spin_sleep_wait or park_wait.
+ */
+template <boost::uint32_t size = 256u, typename Wait = park_wait<> >
+class work_stealing_pool {
+public:
+	typedef boost::function<void()> task;
+
+	/*! \brief Creates the pool and starts the workers.
+	 * 
+	 * @param workers Number of worker threads, e.g. boost::thread::hardware_concurrency().
+	 */
+	explicit work_stealing_pool(boost::uint32_t workers) :
+		mCount(workers),
+		mCurrent(&noCleanup)
+	{
+		createWorkers(NULL);
+	}
+
+	/*! \brief Creates the pool with the deques on NUMA nodes, and starts the workers.
+	 * 
+	 * The worker threads are not pinned, bind the process to the nodes (e.g. with numactl), or pin them from a task.
+	 * 
+	 * @param workers Number of worker threads.
+	 * @param placements Placement of each worker's deque, workers with the same node steal from each other first.
+	 */
+	work_stealing_pool(boost::uint32_t workers, const memory_placement *placements) :
+		mCount(workers),
+		mCurrent(&noCleanup)
+	{
+		createWorkers(placements);
+	}
+
+	/*! \brief Waits for all tasks and stops the workers.
+	 */
+	~work_stealing_pool(){
+		mStop.storeRelease(true);
+		mParking.notify();
+		mThreads.join_all();
+	}
+
+	/*! \brief Adds a task to the pool.
+	 * 
+	 * Thread-safe. From a worker thread, the task goes to the worker's own deque.
+	 * From other threads, or when the deque is full, it goes to the shared queue.
+	 * When both are full, a worker runs the task itself, other threads wait for the workers.
+	 * 
+	 * @param job The task to run.
+	 */
+	void submit(const task &job){
+		//a throwing allocation would leave the task pending forever.
+		task *item = new task(job);
+		mPending.fetchAdd(1);
+		worker *self = mCurrent.get();
+		if(!self){
+			mShared.push(item);
+		} else if(!self->tasks.push(item) && !mShared.tryPush(item)){
+			//waiting for other workers could dead-lock.
+			runTask(item);
+			return;
+		}
+		mParking.notify();
+	}
+
+	/*! \brief Waits, until all submitted tasks are done.
+	 * 
+	 * Don't call it from a task, it would wait for itself.
+	 */
+	void waitIdle(){
+		Wait waiter(mParking);
+		while(mPending.loadAcquire() != 0){
+			waiter.wait();
+		}
+	}
+
+	/*! \brief Gets the number of submitted tasks, which are not done yet.
+	 */
+	boost::uint32_t getPendingCount(){
+		return mPending.loadRelaxed();
+	}
+
+	/*! \brief Gets the number of worker threads.
+	 */
+	boost::uint32_t getWorkerCount() const {
+		return mCount;
+	}
+private:
+	work_stealing_pool(const work_stealing_pool&);
+	work_stealing_pool& operator=(const work_stealing_pool&);
+
+	struct worker {
+		work_stealing_queue<task*, size> tasks;
+	};
+
+	void createWorkers(const memory_placement *placements){
+		BOOST_ASSERT(mCount != 0);
+		//mWorkers frees the created workers, when one of them throws.
+		mWorkers.reserve(mCount);
+		for(boost::uint32_t i = 0; i < mCount; i++){
+			mWorkers.create(placements ? placements[i] : memory_placement());
+		}
+		try {
+			for(boost::uint32_t i = 0; i < mCount; i++){
+				mThreads.create_thread(boost::bind(&work_stealing_pool::run, this, i));
+			}
+		} catch(...) {
+			//the started workers would use the freed deques.
+			mStop.storeRelease(true);
+			mParking.notify();
+			mThreads.join_all();
+			throw;
+		}
+	}
+
+	//mCurrent doesn't own the worker.
+	static void noCleanup(worker*){ }
+
+	void run(boost::uint32_t index){
+		boost::this_thread::disable_interruption di;
+		worker &self = mWorkers[index];
+		mCurrent.reset(&self);
+
+		task *item;
+		for(;;){
+			if(!findTask(index, item)){
+				Wait waiter(mParking);
+				bool stop = false;
+				while(!findTask(index, item)){
+					//all tasks are done, when the pool is stopped and there is nothing to find.
+					if(stop)
+						return;
+					stop = mStop.loadAcquire();
+					if(!stop)
+						waiter.wait();
+				}
+			}
+			runTask(item);
+		}
+	}
+	//frees the task and counts it as done, also when it throws.
+	struct task_guard {
+		task_guard(work_stealing_pool &pool, task *item) : mPool(pool), mItem(item) { }
+		~task_guard(){
+			delete mItem;
+			//the last task wakes up waitIdle().
+			if(mPool.mPending.fetchAdd((boost::uint32_t)-1) == 1)
+				mPool.mParking.notify();
+		}
+	private:
+		work_stealing_pool &mPool;
+		task *mItem;
+	};
+	void runTask(task *item){
+		task_guard guard(*this, item);
+		(*item)();
+	}
+	//own deque first, then shared queue, then the workers of the same node, then the others.
+	bool findTask(boost::uint32_t index, task *&item){
+		if(mWorkers[index].tasks.pop(item))
+			return true;
+		if(mShared.tryPop(item))
+			return true;
+		int node = mWorkers.placement(index).node;
+		for(boost::uint32_t i = 1; i < mCount; i++){
+			boost::uint32_t victim = (index + i) % mCount;
+			if(mWorkers.placement(victim).node == node && mWorkers[victim].tasks.steal(item))
+				return true;
+		}
+		for(boost::uint32_t i = 1; i < mCount; i++){
+			boost::uint32_t victim = (index + i) % mCount;
+			if(mWorkers.placement(victim).node != node && mWorkers[victim].tasks.steal(item))
+				return true;
+		}
+		return false;
+	}
+
+	circular_queue_detail::placed_array<worker> mWorkers; // one for every thread
+	const boost::uint32_t mCount; // number of workers
+	circular_queue<task*, size> mShared; // tasks from outside threads
+	boost::thread_specific_ptr<worker> mCurrent; // worker of the calling thread, null outside the pool
+	circular_queue_detail::atomic<boost::uint32_t> mPending; // submitted, but not done tasks
+	circular_queue_detail::atomic<bool> mStop;
+	typename Wait::parking mParking; //wakes up idle workers for park_wait
+	boost::thread_group mThreads;
+};
+
+#endif //WORK_STEALING_POOL_H
@@ -0,0 +1,150 @@
+/**
+ * @file
+ * @author Peter Szucs <peter.szucs.dev@gmail.com>
+ *
+ * @section LICENSE
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @class work_stealing_queue
+ * \brief Bounded Chase-Lev work-stealing deque.
+ * 
+ * One owner thread pushes and pops at the bottom (LIFO, the last pushed task is still in the cache),
+ * other threads steal from the top (FIFO, the oldest task). The owner only touches the top position,
+ * when the deque is almost empty, so there is no contention while it has enough items.
+ * Items are read before the steal is confirmed, so T needs to be trivially copyable (e.g. pointer to task).
+ *
+ * example: see work_stealing_pool.h, it has one of them for every worker.
+ */
+
+#ifndef WORK_STEALING_QUEUE_H
+#define WORK_STEALING_QUEUE_H
+
+#include "circular_queue.h"
+#include <boost/type_traits/is_trivially_copyable.hpp>
+
+/*! \brief The work-stealing deque.
+ * 
+ * @tparam T Type of the items, needs to be trivially copyable.
+ * @tparam size Number of slots, needs to be power of two.
+ */
+template <typename T, boost::uint32_t size = 256u>
+class work_stealing_queue {
+public:
+	work_stealing_queue()
+	{
+		// 0x100000000 needs to be dividable by size or it will fail on overflow.
+		BOOST_STATIC_ASSERT( (0xFFFFFFFFu % size) == (size - 1) );
+		//thieves may read a slot, while the owner overwrites it.
+		BOOST_STATIC_ASSERT( boost::is_trivially_copyable<T>::value );
+	}
+
+	/*! \brief Push item to the bottom.
+	 * 
+	 * Only the owner thread may push.
+	 * 
+	 * @param item The item to push to the queue.
+	 * @return True, when the item is pushed. False, when queue is full.
+	 */
+	bool push(const T &item){
+		boost::uint32_t bottom = mBottom.value.loadRelaxed();
+		boost::uint32_t top = mTop.value.loadAcquire();
+		if(bottom - top >= size)
+			return false;
+		mSlots[bottom & (size - 1)].storeRelaxed(item);
+		//the item is written before the thieves can see it.
+		mBottom.value.storeRelease(bottom + 1);
+		return true;
+	}
+
+	/*! \brief Pop the last pushed item from the bottom.
+	 * 
+	 * Only the owner thread may pop.
+	 * 
+	 * @param item Item, where the popped item will be copied.
+	 * @return True, when success. False, when queue is empty or the last item was stolen.
+	 */
+	bool pop(T &item){
+		boost::uint32_t bottom = mBottom.value.loadRelaxed() - 1;
+		mBottom.value.storeRelaxed(bottom);
+		//thieves either see the new bottom, or we see their top.
+		circular_queue_detail::fenceSeqCst();
+		boost::uint32_t top = mTop.value.loadRelaxed();
+
+		if((boost::int32_t)(bottom - top) < 0){
+			//queue was empty.
+			mBottom.value.storeRelaxed(bottom + 1);
+			return false;
+		}
+		item = mSlots[bottom & (size - 1)].loadRelaxed();
+		if(bottom != top)
+			return true;
+
+		//last item, race with the thieves for it.
+		bool success = mTop.value.compareExchange(top, top + 1);
+		mBottom.value.storeRelaxed(bottom + 1);
+		return success;
+	}
+
+	/*! \brief Steal the oldest item from the top.
+	 * 
+	 * Thread-safe, any thread may steal.
+	 * 
+	 * @param item Item, where the stolen item will be copied.
+	 * @return True, when success. False, when queue is empty or other thread was faster.
+	 */
+	bool steal(T &item){
+		boost::uint32_t top = mTop.value.loadAcquire();
+		//pairs with the fence in pop().
+		circular_queue_detail::fenceSeqCst();
+		boost::uint32_t bottom = mBottom.value.loadAcquire();
+		if((boost::int32_t)(bottom - top) <= 0)
+			return false;
+
+		T stolen = mSlots[top & (size - 1)].loadRelaxed();
+		if(!mTop.value.compareExchange(top, top + 1))
+			return false;
+		item = stolen;
+		return true;
+	}
+
+	/*! \brief Gets the estimated length of the queue
+	 * 
+	 * It can be negative for a short time, while the owner pops from an empty queue.
+	 */
+	int getQueueLength(){
+		return (int)(mBottom.value.loadRelaxed() - mTop.value.loadRelaxed());
+	}
+
+	/*! \brief Gets the number of slots in the queue.
+	 */
+	boost::uint32_t getCapacity() const {
+		return size;
+	}
+private:
+	work_stealing_queue(const work_stealing_queue&);
+	work_stealing_queue& operator=(const work_stealing_queue&);
+
+	//the owner works on mBottom, the thieves on mTop.
+	circular_queue_detail::layout_cell<circular_queue_detail::atomic<boost::uint32_t>, padded_layout> mTop; // steal position
+	circular_queue_detail::layout_cell<circular_queue_detail::atomic<boost::uint32_t>, padded_layout> mBottom; // push and pop position
+	circular_queue_detail::atomic<T> mSlots[size]; // queue items
+};
+
+#endif //WORK_STEALING_QUEUE_H